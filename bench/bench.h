@@ -0,0 +1,79 @@
+/**
+ * @file bench.h
+ * @brief Timing helpers shared by the fixed-work benchmarks
+ *
+ * Every case runs a fixed number of iterations BENCH_REPEAT times and keeps
+ * the fastest repetition, which is far less sensitive to scheduler noise
+ * than the mean. Results are printed as a table, or with --json as one
+ * object mapping case names to picoseconds per operation, which is what the
+ * perf tests compare against bench/baseline.json.
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "../include/util.h"
+
+/** Number of timed repetitions of every case */
+#define BENCH_REPEAT 7
+
+/**
+ * @brief Benchmark case, runs iters operations
+ */
+typedef void (*bench_fn)(long);
+
+struct bench_case {
+	const char *name;   /**< Case name, key in the baseline */
+	bench_fn fn;        /**< Case body */
+	long iters;         /**< Operations per repetition */
+};
+
+/** Consumes results so the compiler cannot drop the work */
+static volatile uint64_t bench_sink;
+
+/**
+ * @brief Runs every case and prints the results
+ *
+ * @param[in] cases Benchmark cases
+ * @param[in] ncases Number of cases
+ * @param[in] argc Argument count of main
+ * @param[in] argv Arguments of main, --json selects JSON output
+ * @return 0
+ */
+static inline int bench_main(const struct bench_case *cases, size_t ncases,
+			     int argc, char **argv)
+{
+	int json = argc > 1 && strcmp(argv[1], "--json") == 0;
+
+	if (json)
+		printf("{\n");
+	else
+		printf("%-24s %12s\n", "case", "ns/op");
+	for (size_t i = 0; i < ncases; i++) {
+		// Untimed warm-up run
+		cases[i].fn(cases[i].iters / 10 + 1);
+		double best = 0;
+		for (int r = 0; r < BENCH_REPEAT; r++) {
+			uint64_t start = monotonic_ns();
+			cases[i].fn(cases[i].iters);
+			double ns = (double)(monotonic_ns() - start) /
+				    cases[i].iters;
+			if (r == 0 || ns < best)
+				best = ns;
+		}
+		if (json)
+			printf("  \"%s\": %.0f%s\n", cases[i].name,
+			       best * 1000, i + 1 < ncases ? "," : "");
+		else
+			printf("%-24s %12.3f\n", cases[i].name, best);
+	}
+	if (json)
+		printf("}\n");
+	return 0;
+}
+
+#endif // BENCH_H_
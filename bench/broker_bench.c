@@ -0,0 +1,120 @@
+/**
+ * @file broker_bench.c
+ * @brief Fixed-work benchmark of the broker routing hot paths
+ *
+ * A fleet of SUBSCRIPTIONS device subscriptions plus a few wildcard
+ * listeners is loaded into the subscription trie, then PUBLISH topics are
+ * routed with a trie walk, through the match cache and with the plain
+ * topic_match filter check.
+ *
+ * Usage: broker_bench [--json]
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "../include/intern.h"
+#include "../include/matchcache.h"
+#include "../include/topic.h"
+#include "../include/trie.h"
+
+#define SUBSCRIPTIONS 10000
+#define TOPICS 1024
+
+static struct sub_trie trie;
+static struct intern_table table;
+static struct match_cache cache;
+static char topics[TOPICS][64];
+static size_t topic_lens[TOPICS];
+static uint32_t topic_ids[TOPICS];
+
+static void subscribe(const char *filter, unsigned client)
+{
+	struct subscription sub = { .client = client, .qos = client % 3 };
+	int rc = trie_subscribe(&trie, (const unsigned char *)filter,
+				strlen(filter), sub);
+	assert(rc == 0);
+	(void)rc;
+}
+
+static void setup(void)
+{
+	char filter[64];
+	trie_init(&trie);
+	intern_init(&table);
+	match_cache_init(&cache, TOPICS);
+
+	for (unsigned i = 0; i < SUBSCRIPTIONS; i++) {
+		snprintf(filter, sizeof(filter), "site/%u/device/%u/cmd", i % 16,
+			 i);
+		subscribe(filter, i);
+	}
+	subscribe("site/+/device/+/telemetry", SUBSCRIPTIONS);
+	subscribe("site/3/#", SUBSCRIPTIONS + 1);
+	subscribe("#", SUBSCRIPTIONS + 2);
+
+	for (unsigned i = 0; i < TOPICS; i++) {
+		topic_lens[i] = snprintf(topics[i], sizeof(topics[i]),
+					 "site/%u/device/%u/%s", i % 16,
+					 i * 7 % SUBSCRIPTIONS,
+					 i % 2 ? "cmd" : "telemetry");
+		topic_ids[i] = intern_acquire(&table,
+					      (const unsigned char *)topics[i],
+					      topic_lens[i]);
+	}
+}
+
+static void trie_route(long iters)
+{
+	struct sub_set out = { 0 };
+	uint64_t sum = 0;
+	for (long i = 0; i < iters; i++) {
+		size_t t = i % TOPICS;
+		trie_match(&trie, (const unsigned char *)topics[t],
+			   topic_lens[t], &out, NULL);
+		sum += out.len;
+	}
+	sub_set_release(&out);
+	bench_sink = sum;
+}
+
+static void cached_route(long iters)
+{
+	uint64_t sum = 0;
+	for (long i = 0; i < iters; i++) {
+		const struct topic_entry *entry =
+			intern_lookup(&table, topic_ids[i % TOPICS]);
+		sum += match_cache_lookup(&cache, &trie, entry)->len;
+	}
+	bench_sink = sum;
+}
+
+static void filter_match(long iters)
+{
+	static const char filter[] = "site/+/device/+/telemetry";
+	uint64_t sum = 0;
+	for (long i = 0; i < iters; i++) {
+		size_t t = i % TOPICS;
+		sum += topic_match((const unsigned char *)filter,
+				   sizeof(filter) - 1,
+				   (const unsigned char *)topics[t],
+				   topic_lens[t]);
+	}
+	bench_sink = sum;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct bench_case cases[] = {
+		{ "trie_route", trie_route, 100000 },
+		{ "cached_route", cached_route, 2000000 },
+		{ "filter_match", filter_match, 2000000 },
+	};
+	setup();
+	int rc = bench_main(cases, sizeof(cases) / sizeof(cases[0]), argc,
+			    argv);
+	match_cache_destroy(&cache);
+	intern_destroy(&table);
+	trie_destroy(&trie);
+	return rc;
+}
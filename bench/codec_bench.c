@@ -0,0 +1,88 @@
+/**
+ * @file codec_bench.c
+ * @brief Fixed-work benchmark of the packet codec hot paths
+ *
+ * Covers the remaining length codec of mqtt.c and the pack.c primitives a
+ * PUBLISH goes through on its way in and out of the broker.
+ *
+ * Usage: codec_bench [--json]
+ */
+
+#include "bench.h"
+#include "../include/mqtt.h"
+#include "../include/pack.h"
+
+static const char TOPIC[] = "factory/line-3/press-12/telemetry";
+static unsigned char payload[256];
+static unsigned char frame[512];
+
+static void encode_length(long iters)
+{
+	unsigned char buf[4];
+	uint64_t sum = 0;
+	for (long i = 0; i < iters; i++)
+		sum += mqtt_encode_length(buf, (size_t)i & 0x0fffffff);
+	bench_sink = sum;
+}
+
+static void decode_length(long iters)
+{
+	static const unsigned char lengths[4][4] = {
+		{ 0x7f }, { 0xff, 0x7f }, { 0xff, 0xff, 0x7f },
+		{ 0xff, 0xff, 0xff, 0x7f }
+	};
+	uint64_t sum = 0;
+	for (long i = 0; i < iters; i++) {
+		const unsigned char *ptr = lengths[i & 3];
+		sum += mqtt_decode_length(&ptr);
+	}
+	bench_sink = sum;
+}
+
+static size_t encode_publish(unsigned char *buf)
+{
+	uint8_t *ptr = buf;
+	uint16_t topiclen = sizeof(TOPIC) - 1;
+	pack_u8(&ptr, PUBLISH_BYTE | 2);
+	ptr += mqtt_encode_length(ptr, 2 * sizeof(uint16_t) + topiclen +
+					       sizeof(payload));
+	pack_string16(&ptr, (const uint8_t *)TOPIC, topiclen);
+	pack_u16(&ptr, 42);
+	pack_nbytes(&ptr, payload, sizeof(payload));
+	return ptr - buf;
+}
+
+static void pack_publish(long iters)
+{
+	uint64_t sum = 0;
+	for (long i = 0; i < iters; i++)
+		sum += encode_publish(frame);
+	bench_sink = sum;
+}
+
+static void unpack_publish(long iters)
+{
+	uint64_t sum = 0;
+	for (long i = 0; i < iters; i++) {
+		const uint8_t *ptr = frame;
+		const uint8_t *topic;
+		uint8_t byte = unpack_u8(&ptr);
+		size_t len = mqtt_decode_length(&ptr);
+		uint16_t topiclen = unpack_string16_view(&ptr, &topic);
+		uint16_t pkt_id = unpack_u16(&ptr);
+		sum += byte + len + topiclen + pkt_id + topic[topiclen - 1];
+	}
+	bench_sink = sum;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct bench_case cases[] = {
+		{ "encode_length", encode_length, 20000000 },
+		{ "decode_length", decode_length, 20000000 },
+		{ "pack_publish", pack_publish, 5000000 },
+		{ "unpack_publish", unpack_publish, 10000000 },
+	};
+	encode_publish(frame);
+	return bench_main(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
@@ -0,0 +1,235 @@
+/**
+ * @file transport_bench.c
+ * @brief Compares loopback TCP and Unix domain socket transports
+ *
+ * Both transports carry the same workload of QoS 0 PUBLISH frames, encoded
+ * with mqtt_encode_length and the pack module and decoded on the other side
+ * with mqtt_decode_length, the way a co-located publisher talks to the
+ * broker. Throughput sends one frame per write while a reader thread decodes
+ * them. Latency sends a frame and waits for it to be echoed back.
+ *
+ * Usage: transport_bench [messages] [payload_size] [socket_buffer]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../include/mqtt.h"
+#include "../include/network.h"
+#include "../include/pack.h"
+#include "../include/util.h"
+
+/** Number of echoed round trips for the latency run */
+#define ROUND_TRIPS 10000
+/** Largest frame the benchmark handles */
+#define MAX_FRAME (1024 * 1024)
+
+struct transport {
+	const char *name;
+	int listen_fd;
+	int sockbuf;
+	int (*connect)(const struct transport *);
+	char address[108];
+};
+
+struct reader {
+	int fd;
+	long messages;
+	int echo;
+	size_t bytes;
+};
+
+static int connect_tcp(const struct transport *t)
+{
+	return make_connection("127.0.0.1", t->address);
+}
+
+static int connect_uds(const struct transport *t)
+{
+	return make_unix_connection(t->address);
+}
+
+/**
+ * @brief Encodes a QoS 0 PUBLISH frame, returns its length
+ */
+static size_t encode_publish(unsigned char *buf, const char *topic,
+			     const unsigned char *payload, size_t len)
+{
+	uint8_t *ptr = buf;
+	uint16_t topiclen = strlen(topic);
+	pack_u8(&ptr, PUBLISH_BYTE);
+	ptr += mqtt_encode_length(ptr, sizeof(uint16_t) + topiclen + len);
+	pack_string16(&ptr, (const uint8_t *)topic, topiclen);
+	pack_nbytes(&ptr, payload, len);
+	return ptr - buf;
+}
+
+/**
+ * @brief Reads one whole MQTT frame, returns its length or 0 on EOF
+ */
+static size_t read_frame(int fd, unsigned char *buf)
+{
+	size_t n = 0;
+	if (recv_bytes(fd, buf, 2) <= 0)
+		return 0;
+	n = 2;
+	while ((buf[n - 1] & 128) && n < 5) {
+		if (recv_bytes(fd, buf + n, 1) <= 0)
+			return 0;
+		n++;
+	}
+	const unsigned char *ptr = buf + 1;
+	size_t len = mqtt_decode_length(&ptr);
+	if (n + len > MAX_FRAME || recv_bytes(fd, buf + n, len) <= 0)
+		return 0;
+	return n + len;
+}
+
+static void *reader_loop(void *arg)
+{
+	struct reader *r = arg;
+	unsigned char *buf = malloc(MAX_FRAME);
+	size_t n;
+	while ((n = read_frame(r->fd, buf)) > 0) {
+		r->messages++;
+		r->bytes += n;
+		if (r->echo && send_bytes(r->fd, buf, n) == -1)
+			break;
+	}
+	free(buf);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief Opens a client connection and accepts its server side
+ *
+ * Accepted Unix domain sockets do not inherit the listener's buffer sizes,
+ * so both ends are sized here.
+ */
+static int open_pair(const struct transport *t, int *client, int *server)
+{
+	*client = t->connect(t);
+	if (*client == -1)
+		return -1;
+	*server = accept(t->listen_fd, NULL, NULL);
+	if (*server == -1) {
+		close(*client);
+		return -1;
+	}
+	set_socket_buffers(*client, t->sockbuf);
+	set_socket_buffers(*server, t->sockbuf);
+	return 0;
+}
+
+static int run(const struct transport *t, long messages, size_t payload_size)
+{
+	unsigned char *payload = calloc(1, payload_size);
+	unsigned char *frame = malloc(MAX_FRAME);
+	unsigned char *echo = malloc(MAX_FRAME);
+	uint64_t *rtt = malloc(ROUND_TRIPS * sizeof(*rtt));
+	int client, server, rc = -1;
+	pthread_t tid;
+
+	if (!payload || !frame || !echo || !rtt)
+		goto out;
+	size_t len = encode_publish(frame, "gateway/1/telemetry", payload,
+				    payload_size);
+
+	// Throughput: one write per frame, reader decodes until EOF
+	if (open_pair(t, &client, &server) == -1)
+		goto out;
+	struct reader r = { .fd = server };
+	pthread_create(&tid, NULL, reader_loop, &r);
+	uint64_t start = monotonic_ns();
+	for (long i = 0; i < messages; i++)
+		send_bytes(client, frame, len);
+	shutdown(client, SHUT_WR);
+	pthread_join(tid, NULL);
+	double secs = (monotonic_ns() - start) / 1e9;
+	close(client);
+	close(server);
+	if (r.messages != messages)
+		goto out;
+
+	// Latency: echoed round trips
+	if (open_pair(t, &client, &server) == -1)
+		goto out;
+	struct reader e = { .fd = server, .echo = 1 };
+	pthread_create(&tid, NULL, reader_loop, &e);
+	for (int i = 0; i < ROUND_TRIPS; i++) {
+		uint64_t t0 = monotonic_ns();
+		send_bytes(client, frame, len);
+		read_frame(client, echo);
+		rtt[i] = monotonic_ns() - t0;
+	}
+	shutdown(client, SHUT_WR);
+	pthread_join(tid, NULL);
+	close(client);
+	close(server);
+	qsort(rtt, ROUND_TRIPS, sizeof(*rtt), cmp_u64);
+
+	printf("%-4s %12.0f %10.1f %10.2f %10.2f\n", t->name,
+	       messages / secs, r.bytes / secs / (1024 * 1024),
+	       rtt[ROUND_TRIPS / 2] / 1000.0,
+	       rtt[ROUND_TRIPS * 99 / 100] / 1000.0);
+	rc = 0;
+out:
+	free(echo);
+	free(rtt);
+	free(frame);
+	free(payload);
+	return rc;
+}
+
+int main(int argc, char **argv)
+{
+	long messages = argc > 1 ? atol(argv[1]) : 200000;
+	size_t payload_size = argc > 2 ? (size_t)atol(argv[2]) : 256;
+	int sockbuf = argc > 3 ? atoi(argv[3]) : 0;
+
+	if (payload_size > MAX_FRAME / 2) {
+		fprintf(stderr, "payload_size must be at most %d\n",
+			MAX_FRAME / 2);
+		return EXIT_FAILURE;
+	}
+
+	struct transport tcp = { .name = "tcp", .connect = connect_tcp };
+	struct transport uds = { .name = "uds", .connect = connect_uds };
+
+	tcp.listen_fd = make_listen("127.0.0.1", "0");
+	snprintf(uds.address, sizeof(uds.address), "/tmp/cmqtt_bench_%d.sock",
+		 (int)getpid());
+	uds.listen_fd = make_unix_listen(uds.address);
+	if (tcp.listen_fd == -1 || uds.listen_fd == -1) {
+		perror("listen");
+		return EXIT_FAILURE;
+	}
+	snprintf(tcp.address, sizeof(tcp.address), "%d",
+		 socket_port(tcp.listen_fd));
+	// TCP negotiates its window from the listener's receive buffer
+	set_socket_buffers(tcp.listen_fd, sockbuf);
+	tcp.sockbuf = uds.sockbuf = sockbuf;
+
+	printf("%ld messages, %zu byte payload, socket buffer %s\n", messages,
+	       payload_size, sockbuf > 0 ? argv[3] : "default");
+	printf("%-4s %12s %10s %10s %10s\n", "", "msg/s", "MiB/s", "p50_us",
+	       "p99_us");
+
+	int rc = run(&tcp, messages, payload_size) == 0 &&
+		 run(&uds, messages, payload_size) == 0;
+
+	close(tcp.listen_fd);
+	close(uds.listen_fd);
+	unlink(uds.address);
+	return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,106 @@
+# Runs a fixed-work benchmark and compares it against the stored baseline
+#
+#   cmake -DBENCH=<exe> -DNAME=<name> -DBASELINE=<json> -DTOLERANCE=<percent>
+#         [-DUPDATE=ON] -P perf_check.cmake
+#
+# The baseline maps every benchmark name to its cases, each holding the
+# picoseconds per operation of the reference run and optionally its own
+# tolerance in percent:
+#
+#   { "codec_bench": { "decode_length": { "ps_per_op": 2100,
+#                                         "tolerance": 50 } } }
+#
+# A case fails when it is more than tolerance percent slower. A slow run is
+# repeated up to RUNS times, keeping the fastest result of every case, so a
+# burst of noise on a shared machine does not fail the gate. With UPDATE=ON
+# the fastest of RUNS runs is written back instead, keeping any per-case
+# tolerance.
+
+cmake_minimum_required(VERSION 3.19)
+
+set(RUNS 3)
+
+foreach(var BENCH NAME BASELINE TOLERANCE)
+    if (NOT DEFINED ${var})
+        message(FATAL_ERROR "perf_check: ${var} is not set")
+    endif()
+endforeach()
+
+if (EXISTS ${BASELINE})
+    file(READ ${BASELINE} baseline)
+else()
+    set(baseline "{}")
+endif()
+string(JSON stored ERROR_VARIABLE missing GET "${baseline}" ${NAME})
+if (missing)
+    set(stored "{}")
+endif()
+
+set(best "{}")
+foreach(run RANGE 1 ${RUNS})
+    execute_process(COMMAND ${BENCH} --json
+                    OUTPUT_VARIABLE result
+                    RESULT_VARIABLE rc)
+    if (NOT rc EQUAL 0)
+        message(FATAL_ERROR "${NAME} failed with ${rc}")
+    endif()
+
+    string(JSON ncases LENGTH "${result}")
+    math(EXPR last "${ncases} - 1")
+    set(report)
+    set(regressions 0)
+    foreach(i RANGE ${last})
+        string(JSON case MEMBER "${result}" ${i})
+        string(JSON measured GET "${result}" ${case})
+        string(JSON previous ERROR_VARIABLE missing GET "${best}" ${case})
+        if (NOT missing AND previous LESS measured)
+            set(measured ${previous})
+        endif()
+        string(JSON best SET "${best}" ${case} ${measured})
+
+        string(JSON reference ERROR_VARIABLE missing
+               GET "${stored}" ${case} ps_per_op)
+        if (UPDATE OR missing)
+            list(APPEND report "${case}: ${measured} ps/op")
+            continue()
+        endif()
+        string(JSON tolerance ERROR_VARIABLE missing
+               GET "${stored}" ${case} tolerance)
+        if (missing)
+            set(tolerance ${TOLERANCE})
+        endif()
+
+        math(EXPR limit "${reference} * (100 + ${tolerance}) / 100")
+        if (measured GREATER limit)
+            list(APPEND report "${case}: ${measured} ps/op, baseline ${reference} ps/op, REGRESSED (+${tolerance}% allowed)")
+            math(EXPR regressions "${regressions} + 1")
+        else()
+            list(APPEND report "${case}: ${measured} ps/op, baseline ${reference} ps/op")
+        endif()
+    endforeach()
+
+    if (NOT UPDATE AND regressions EQUAL 0)
+        break()
+    endif()
+endforeach()
+
+foreach(line IN LISTS report)
+    message(STATUS "${NAME}.${line}")
+endforeach()
+
+if (UPDATE)
+    foreach(i RANGE ${last})
+        string(JSON case MEMBER "${best}" ${i})
+        string(JSON measured GET "${best}" ${case})
+        string(JSON entry ERROR_VARIABLE missing GET "${stored}" ${case})
+        if (missing)
+            set(entry "{}")
+        endif()
+        string(JSON entry SET "${entry}" ps_per_op ${measured})
+        string(JSON stored SET "${stored}" ${case} "${entry}")
+    endforeach()
+    string(JSON baseline SET "${baseline}" ${NAME} "${stored}")
+    file(WRITE ${BASELINE} "${baseline}\n")
+elseif (regressions GREATER 0)
+    message(FATAL_ERROR "${NAME}: ${regressions} case(s) regressed")
+endif()
@@ -0,0 +1,157 @@
+/**
+ * @file auth.h
+ * @brief The auth module verifies CONNECT credentials off the event loop
+ *
+ * Password hashing schemes such as bcrypt or argon2 are deliberately slow,
+ * so credential checks are handed to a small pool of worker threads instead
+ * of running inline on a connection's thread. Successful verifications are
+ * remembered for a while in a bounded cache keyed by a keyed hash of the
+ * credentials, so a reconnect storm does not hash every password again.
+ * The queue in front of the workers is bounded as well: once it is full,
+ * further CONNECTs are refused instead of piling up passwords in memory.
+ */
+
+#ifndef AUTH_H_
+#define AUTH_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Default number of jobs that may wait for a worker */
+#define AUTH_DEFAULT_MAX_QUEUED 1024
+
+/** @name Auth Submit Results */
+/**@{*/
+/** Credentials were verified from the cache, no callback follows */
+#define AUTH_CACHED 1
+/** Credentials were queued, the callback reports the result */
+#define AUTH_PENDING 0
+/**@}*/
+
+/**
+ * @brief Checks a username and password, may block for a long time
+ *
+ * @param[in] username Username bytes
+ * @param[in] ulen Username length
+ * @param[in] password Password bytes
+ * @param[in] plen Password length
+ * @param[in] arg User supplied argument
+ * @return 1 if the credentials are valid, 0 otherwise
+ */
+typedef int (*auth_verify_fn)(const unsigned char *, size_t,
+			      const unsigned char *, size_t, void *);
+
+/**
+ * @brief Returns the current time of the cache in nanoseconds
+ *
+ * @return Monotonic timestamp
+ */
+typedef uint64_t (*auth_clock_fn)(void);
+
+/**
+ * @brief Receives the result of a queued verification
+ *
+ * Runs on a worker thread, so it should only hand the result back to the
+ * thread owning the connection, which then sends the CONNACK.
+ *
+ * @param[in] ok 1 if the credentials are valid, 0 otherwise
+ * @param[in] arg Argument given to auth_submit
+ */
+typedef void (*auth_done_cb)(int, void *);
+
+/**
+ * @brief Queued verification request
+ */
+struct auth_job {
+	unsigned char *username;   /**< Copy of the username */
+	size_t ulen;               /**< Username length */
+	unsigned char *password;   /**< Copy of the password, wiped after use */
+	size_t plen;               /**< Password length */
+	uint64_t key[2];           /**< Cache key of the credentials */
+	auth_done_cb cb;           /**< Completion callback */
+	void *arg;                 /**< Callback argument */
+	struct auth_job *next;     /**< Next queued job */
+};
+
+/**
+ * @brief Bounded cache of recently verified credentials
+ */
+struct auth_cache {
+	pthread_mutex_t lock;      /**< Protects the entries */
+	struct {
+		uint64_t key[2];     /**< Keyed hash of the credentials */
+		uint64_t expires;    /**< Expiry in CLOCK_MONOTONIC ns */
+	} *entries;                /**< Direct-mapped slots */
+	size_t cap;                /**< Number of slots, power of two */
+	uint64_t ttl_ns;           /**< Lifetime of an entry */
+	auth_clock_fn now;         /**< Clock of the expiry times,
+				        CLOCK_MONOTONIC unless replaced */
+	uint64_t secret[2];        /**< Hash key, random per process */
+	uint64_t hits;             /**< Lookups served from the cache */
+	uint64_t misses;           /**< Lookups that needed a worker */
+};
+
+/**
+ * @brief Pool of credential verification workers
+ */
+struct auth_pool {
+	pthread_t *workers;        /**< Worker threads */
+	size_t nworkers;           /**< Number of workers */
+	pthread_mutex_t lock;      /**< Protects the queue */
+	pthread_cond_t cond;       /**< Signals queued jobs or shutdown */
+	struct auth_job *head;     /**< First queued job */
+	struct auth_job *tail;     /**< Last queued job */
+	size_t queued;             /**< Number of queued jobs */
+	size_t max_queued;         /**< Queue bound */
+	int running;               /**< Cleared by auth_pool_destroy */
+	auth_verify_fn verify;     /**< Credential check */
+	void *verify_arg;          /**< Argument of the credential check */
+	struct auth_cache cache;   /**< Verified credentials */
+};
+
+/**
+ * @brief Starts the worker threads
+ *
+ * On failure everything set up so far is released again, including workers
+ * that were already started.
+ *
+ * @param[out] pool Pool to initialize
+ * @param[in] nworkers Number of worker threads, at least one
+ * @param[in] verify Credential check run on the workers
+ * @param[in] arg Argument passed to verify
+ * @param[in] max_queued Number of jobs that may wait for a worker
+ * @param[in] cache_cap Number of cache slots, 0 disables the cache
+ * @param[in] ttl_ms Lifetime of a cached verification in milliseconds
+ * @return 0 on success, -1 on failure
+ */
+int auth_pool_init(struct auth_pool *, size_t, auth_verify_fn, void *, size_t,
+		   size_t, unsigned long);
+
+/**
+ * @brief Verifies credentials from the cache or queues them for a worker
+ *
+ * A full queue is reported with errno set to EAGAIN. The CONNECT should
+ * then be refused with a server unavailable CONNACK, the client retries.
+ *
+ * @param[in,out] pool Auth pool
+ * @param[in] username Username bytes
+ * @param[in] ulen Username length
+ * @param[in] password Password bytes
+ * @param[in] plen Password length
+ * @param[in] cb Callback receiving the result of a queued verification
+ * @param[in] arg Argument passed to cb
+ * @return AUTH_CACHED, AUTH_PENDING, or -1 on failure or if the queue is
+ *         full
+ */
+int auth_submit(struct auth_pool *, const unsigned char *, size_t,
+		const unsigned char *, size_t, auth_done_cb, void *);
+
+/**
+ * @brief Finishes every queued job, then stops and joins the workers
+ *
+ * @param[in,out] pool Pool to destroy
+ */
+void auth_pool_destroy(struct auth_pool *);
+
+#endif // AUTH_H_
@@ -0,0 +1,237 @@
+/**
+ * @file cluster.h
+ * @brief The cluster module defines broker-to-broker bridging over TCP
+ *
+ * Cluster nodes exchange aggregated subscription-interest summaries and only
+ * forward a PUBLISH to the peers whose summary matches its topic. Records are
+ * batched into large frames encoded with the pack module:
+ *
+ *     frame  := u32 body length | u16 record count | record*
+ *     record := u8 CLUSTER_RESET
+ *             | u8 CLUSTER_INTEREST | string16 filter
+ *             | u8 CLUSTER_PUBLISH  | u8 header | u16 pkt_id
+ *                                   | string16 topic | u32 len | payload
+ */
+
+#ifndef CLUSTER_H_
+#define CLUSTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mqtt.h"
+
+/** @name Cluster Frame Constants */
+/**@{*/
+/** Size of the frame header, body length plus record count */
+#define CLUSTER_FRAME_HEADER_LEN 6
+/** Default size at which an outgoing batch is flushed */
+#define CLUSTER_BATCH_SIZE 65536
+/** Upper bound on an incoming frame body, larger frames are rejected */
+#define CLUSTER_MAX_FRAME (16 * 1024 * 1024)
+/**@}*/
+
+/**
+ * @brief Record types carried inside a cluster frame
+ */
+enum cluster_record_type {
+	CLUSTER_RESET = 1,      /**< Drop the sender's previous summary */
+	CLUSTER_INTEREST,       /**< Add a topic filter to the sender's summary */
+	CLUSTER_PUBLISH         /**< Forwarded PUBLISH message */
+};
+
+/**
+ * @brief Aggregated set of topic filters a node has subscribers for
+ *
+ * Adding a filter that is covered by an existing one is a no-op, and adding
+ * a broader filter drops the narrower ones it covers, so the summary stays
+ * as small as the subscription set allows.
+ */
+struct cluster_summary {
+	size_t len;                 /**< Number of filters */
+	size_t cap;                 /**< Allocated filter slots */
+	struct {
+		unsigned short len; /**< Length of the filter */
+		unsigned char *filter;  /**< Filter string */
+	} *filters;                 /**< Array of topic filters */
+};
+
+/**
+ * @brief Outgoing batch of cluster records waiting to be framed and sent
+ */
+struct cluster_batch {
+	unsigned char *buf;    /**< Frame buffer, header space included */
+	size_t len;            /**< Bytes used in buf */
+	size_t cap;            /**< Bytes allocated in buf */
+	unsigned short count;  /**< Records in the batch */
+};
+
+/**
+ * @brief Remote cluster node as seen by the local node
+ */
+struct cluster_peer {
+	int fd;                         /**< Connected socket */
+	struct cluster_summary remote;  /**< Interest summary of the peer */
+	struct cluster_batch out;       /**< Records pending for the peer */
+};
+
+/**
+ * @brief Callback invoked for every PUBLISH received from a peer
+ *
+ * The packet points into the receive buffer and is only valid for the
+ * duration of the call.
+ *
+ * @param[in] peer Peer the message came from
+ * @param[in] pkt Forwarded PUBLISH packet
+ * @param[in] arg User supplied argument
+ */
+typedef void (*cluster_publish_cb)(struct cluster_peer *,
+				   const struct mqtt_publish *, void *);
+
+/**
+ * @brief Initializes an empty summary
+ *
+ * @param[out] summary Summary to initialize
+ */
+void cluster_summary_init(struct cluster_summary *);
+
+/**
+ * @brief Adds a topic filter to a summary, aggregating overlapping filters
+ *
+ * @param[in,out] summary Summary to update
+ * @param[in] filter Topic filter
+ * @param[in] len Length of the topic filter
+ * @return 1 if the summary changed, 0 if the filter was already covered,
+ *         -1 on allocation failure
+ */
+int cluster_summary_add(struct cluster_summary *, const unsigned char *,
+			unsigned short);
+
+/**
+ * @brief Checks whether any filter of a summary matches a topic
+ *
+ * @param[in] summary Summary to check
+ * @param[in] topic Topic name
+ * @param[in] len Length of the topic name
+ * @return 1 if the topic matches, 0 otherwise
+ */
+int cluster_summary_match(const struct cluster_summary *,
+			  const unsigned char *, size_t);
+
+/**
+ * @brief Removes all filters from a summary and frees its memory
+ *
+ * @param[in,out] summary Summary to clear
+ */
+void cluster_summary_clear(struct cluster_summary *);
+
+/**
+ * @brief Initializes an empty batch
+ *
+ * @param[out] batch Batch to initialize
+ */
+void cluster_batch_init(struct cluster_batch *);
+
+/**
+ * @brief Appends a full interest summary to a batch, preceded by a reset
+ *
+ * The summary is appended whole or not at all, the batch is left unchanged
+ * on failure.
+ *
+ * @param[in,out] batch Batch to append to
+ * @param[in] summary Local interest summary
+ * @return 0 on success, -1 on allocation failure or if the records do not
+ *         fit the batch
+ */
+int cluster_batch_add_summary(struct cluster_batch *,
+			      const struct cluster_summary *);
+
+/**
+ * @brief Appends a PUBLISH record to a batch
+ *
+ * @param[in,out] batch Batch to append to
+ * @param[in] pkt PUBLISH packet to forward
+ * @return 0 on success, -1 on allocation failure
+ */
+int cluster_batch_add_publish(struct cluster_batch *,
+			      const struct mqtt_publish *);
+
+/**
+ * @brief Releases the memory held by a batch
+ *
+ * @param[in,out] batch Batch to release
+ */
+void cluster_batch_release(struct cluster_batch *);
+
+/**
+ * @brief Initializes a peer on an already connected socket
+ *
+ * @param[out] peer Peer to initialize
+ * @param[in] fd Connected socket
+ */
+void cluster_peer_init(struct cluster_peer *, int);
+
+/**
+ * @brief Queues the local interest summary for a peer and flushes it
+ *
+ * @param[in,out] peer Peer to announce to
+ * @param[in] summary Local interest summary
+ * @return 0 on success, -1 on failure
+ */
+int cluster_peer_announce(struct cluster_peer *,
+			  const struct cluster_summary *);
+
+/**
+ * @brief Queues a PUBLISH for a peer if its summary matches the topic
+ *
+ * The batch is flushed once it grows past CLUSTER_BATCH_SIZE.
+ *
+ * @param[in,out] peer Destination peer
+ * @param[in] pkt PUBLISH packet to forward
+ * @return 1 if queued, 0 if the peer has no matching subscribers,
+ *         -1 on failure
+ */
+int cluster_peer_forward(struct cluster_peer *, const struct mqtt_publish *);
+
+/**
+ * @brief Frames and sends every record pending for a peer
+ *
+ * @param[in,out] peer Peer to flush
+ * @return 0 on success, -1 on failure
+ */
+int cluster_peer_flush(struct cluster_peer *);
+
+/**
+ * @brief Receives and applies one frame from a peer
+ *
+ * Interest records update the peer's summary, PUBLISH records are handed to
+ * the callback.
+ *
+ * @param[in,out] peer Peer to read from
+ * @param[in] cb Callback for forwarded PUBLISH messages
+ * @param[in] arg User supplied argument passed to cb
+ * @return Number of records applied, 0 if the peer disconnected,
+ *         -1 on failure or malformed frame
+ */
+int cluster_peer_recv(struct cluster_peer *, cluster_publish_cb, void *);
+
+/**
+ * @brief Decodes a frame body and applies its records to a peer
+ *
+ * @param[in,out] peer Peer the frame came from
+ * @param[in] buf Frame body, without the length prefix
+ * @param[in] len Length of the frame body
+ * @param[in] cb Callback for forwarded PUBLISH messages
+ * @param[in] arg User supplied argument passed to cb
+ * @return Number of records applied, -1 on malformed frame
+ */
+int cluster_decode(struct cluster_peer *, const unsigned char *, size_t,
+		   cluster_publish_cb, void *);
+
+/**
+ * @brief Releases the memory held by a peer, the socket is left open
+ *
+ * @param[in,out] peer Peer to release
+ */
+void cluster_peer_release(struct cluster_peer *);
+
+#endif // CLUSTER_H_
@@ -0,0 +1,253 @@
+/**
+ * @file connection.h
+ * @brief The connection module defines the compact per-client state
+ *
+ * Most connections of a large IoT deployment sit idle between keepalives, so
+ * their footprint is what limits how many one broker can hold. The state a
+ * connection touches on every packet fits one cache line, while CONNECT
+ * fields that are only read on session lookup or disconnect, such as the
+ * client ID and the will message, live in a single out-of-line block.
+ *
+ * Read and write buffers are held only while bytes are pending. As soon as a
+ * buffer drains it goes back to a per-thread pool, so an idle connection
+ * holds no buffer at all and a busy thread reuses the same few buffers
+ * instead of going through malloc for every packet.
+ */
+
+#ifndef CONNECTION_H_
+#define CONNECTION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "pktid.h"
+
+/** @name Connection Buffer Constants */
+/**@{*/
+/** Allocation size of a pooled buffer, header included */
+#define CONN_BUF_SIZE 4096
+/** Maximum number of idle buffers a thread keeps for reuse */
+#define CONN_POOL_MAX_IDLE 256
+/** Longest read pause in milliseconds, longer delays are cut short */
+#define CONN_MAX_PAUSE_MS (60 * 1000)
+/** Most bytes a read or write buffer holds, a frame larger than this fails
+    the connection with EMSGSIZE; define it at build time to change it */
+#ifndef CONN_MAX_PACKET
+#define CONN_MAX_PACKET (1024 * 1024)
+#endif
+/**@}*/
+
+/**
+ * @brief Connection lifecycle states
+ */
+enum conn_state {
+	CONN_NEW,          /**< Accepted, waiting for CONNECT */
+	CONN_CONNECTED     /**< CONNECT accepted */
+};
+
+/**
+ * @brief Pending bytes of a connection, data[start, end) is unconsumed
+ */
+struct conn_buf {
+	struct conn_buf *next;   /**< Next idle buffer in the pool */
+	uint32_t start;          /**< First unconsumed byte */
+	uint32_t end;            /**< One past the last stored byte */
+	uint32_t cap;            /**< Size of data */
+	unsigned char data[];    /**< Buffer bytes */
+};
+
+/**
+ * @brief Rarely used CONNECT fields, one allocation per connection
+ */
+struct conn_info {
+	uint16_t client_id_len;      /**< Client identifier length */
+	uint16_t username_len;       /**< Username length, 0 if absent */
+	uint16_t will_topic_len;     /**< Will topic length, 0 if no will */
+	uint16_t will_message_len;   /**< Will message length */
+	uint8_t will_qos;            /**< Will QoS level */
+	uint8_t will_retain;         /**< Will retain flag */
+	unsigned char data[];        /**< Client ID, username, will topic and
+				          will message, back to back */
+};
+
+/**
+ * @brief Decoded CONNECT fields handed to conn_set_info
+ *
+ * Strings are length delimited as on the wire, so they may hold any byte,
+ * NUL included, and need no terminator.
+ */
+struct conn_params {
+	const unsigned char *client_id;      /**< Client identifier */
+	const unsigned char *username;       /**< Username, NULL if absent */
+	const unsigned char *will_topic;     /**< Will topic, NULL if no will */
+	const unsigned char *will_message;   /**< Will message */
+	uint16_t client_id_len;              /**< Client identifier length */
+	uint16_t username_len;               /**< Username length */
+	uint16_t will_topic_len;             /**< Will topic length */
+	uint16_t will_message_len;           /**< Will message length */
+	uint16_t keepalive;                  /**< Keepalive in seconds */
+	uint8_t clean_session;               /**< Clean session flag */
+	uint8_t will_qos;                    /**< Will QoS level */
+	uint8_t will_retain;                 /**< Will retain flag */
+};
+
+/**
+ * @brief Per-connection state, one cache line
+ */
+struct connection {
+	int fd;                       /**< Socket file descriptor */
+	uint16_t keepalive;           /**< Keepalive in seconds */
+	uint8_t state;                /**< enum conn_state */
+	uint8_t clean_session;        /**< Clean session flag */
+	uint32_t paused_until;        /**< Monotonic ms reads resume at, 0 if
+					   reads are not paused */
+	struct conn_buf *rbuf;        /**< Received bytes, NULL when idle */
+	struct conn_buf *wbuf;        /**< Bytes to send, NULL when idle */
+	struct conn_info *info;       /**< CONNECT fields, NULL before CONNECT */
+	struct pktid_set inflight;    /**< Inbound QoS 2 packet IDs */
+};
+
+/**
+ * @brief Initializes the state of an accepted socket
+ *
+ * @param[out] conn Connection to initialize
+ * @param[in] fd Non-blocking socket file descriptor
+ */
+void conn_init(struct connection *, int);
+
+/**
+ * @brief Stores the CONNECT fields of a connection
+ *
+ * @param[in,out] conn Connection
+ * @param[in] params Decoded CONNECT fields, copied
+ * @return 0 on success, -1 on allocation failure or an invalid will
+ */
+int conn_set_info(struct connection *, const struct conn_params *);
+
+/**
+ * @brief Returns the client ID of a connection, not NUL terminated
+ *
+ * @param[in] conn Connection
+ * @param[out] len Length of the client ID
+ * @return Client ID bytes, NULL before CONNECT
+ */
+const unsigned char *conn_client_id(const struct connection *, size_t *);
+
+/**
+ * @brief Returns the username of a connection, not NUL terminated
+ *
+ * @param[in] conn Connection
+ * @param[out] len Length of the username
+ * @return Username bytes, NULL if no username was given
+ */
+const unsigned char *conn_username(const struct connection *, size_t *);
+
+/**
+ * @brief Stops reading from a connection for a while
+ *
+ * Unread bytes stay in the kernel, so once its receive buffer fills the
+ * TCP window closes and the client is slowed down instead of having its
+ * packets dropped. Pauses are capped at CONN_MAX_PAUSE_MS, a client still
+ * over its limit afterwards is paused again by its next PUBLISH.
+ *
+ * @param[in,out] conn Connection
+ * @param[in] delay_ns Pause length in nanoseconds, 0 does nothing
+ */
+void conn_pause(struct connection *, uint64_t);
+
+/**
+ * @brief Returns when reads of a paused connection resume
+ *
+ * An event loop arms a timer for this time instead of waiting for the
+ * socket, which may not signal again: with edge-triggered readiness the
+ * event was already consumed, with level-triggered readiness it would fire
+ * in a loop.
+ *
+ * @param[in] conn Connection
+ * @return CLOCK_MONOTONIC time in milliseconds reads resume at, 0 if the
+ *         connection is not paused
+ */
+uint64_t conn_paused_until(const struct connection *);
+
+/**
+ * @brief Reads available bytes from the socket into the read buffer
+ *
+ * A buffer is taken from the pool first if none is held, and grown when a
+ * frame does not fit, up to CONN_MAX_PACKET. If nothing is left pending
+ * afterwards, the buffer goes straight back to the pool. Nothing is read
+ * while the connection is paused, see conn_paused_until for when to try
+ * again.
+ *
+ * @param[in,out] conn Connection
+ * @return Number of bytes read, 0 if the peer closed the connection,
+ *         -1 on failure, with errno set to EAGAIN if the socket would block,
+ *         to EBUSY while the connection is paused or to EMSGSIZE if a full
+ *         buffer of CONN_MAX_PACKET bytes still holds no complete frame
+ */
+ssize_t conn_recv(struct connection *);
+
+/**
+ * @brief Returns the unconsumed bytes of the read buffer
+ *
+ * @param[in] conn Connection
+ * @param[out] len Number of unconsumed bytes
+ * @return First unconsumed byte, NULL if nothing is pending
+ */
+const unsigned char *conn_pending(const struct connection *, size_t *);
+
+/**
+ * @brief Marks bytes of the read buffer as handled
+ *
+ * The buffer is returned to the pool once everything is consumed.
+ *
+ * @param[in,out] conn Connection
+ * @param[in] len Number of bytes handled, at most the pending length
+ */
+void conn_consume(struct connection *, size_t);
+
+/**
+ * @brief Appends bytes to the write buffer
+ *
+ * At most CONN_MAX_PACKET bytes are held, so a peer that stops reading
+ * cannot make the broker buffer without bound.
+ *
+ * @param[in,out] conn Connection
+ * @param[in] bytes Bytes to send
+ * @param[in] len Number of bytes
+ * @return 0 on success, -1 on allocation failure, or with errno set to
+ *         EMSGSIZE if the pending bytes would exceed CONN_MAX_PACKET
+ */
+int conn_queue(struct connection *, const unsigned char *, size_t);
+
+/**
+ * @brief Sends as much of the write buffer as the socket accepts
+ *
+ * The buffer is returned to the pool once everything is sent.
+ *
+ * @param[in,out] conn Connection
+ * @return Number of bytes still pending, -1 on failure
+ */
+ssize_t conn_flush(struct connection *);
+
+/**
+ * @brief Frees everything a connection holds, the socket is left open
+ *
+ * @param[in,out] conn Connection
+ */
+void conn_release(struct connection *);
+
+/**
+ * @brief Returns the number of idle buffers in the calling thread's pool
+ *
+ * @return Idle buffer count
+ */
+size_t conn_pool_idle(void);
+
+/**
+ * @brief Frees the idle buffers of the calling thread's pool
+ *
+ * Called by a worker thread before it exits.
+ */
+void conn_pool_drain(void);
+
+#endif // CONNECTION_H_
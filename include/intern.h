@@ -0,0 +1,122 @@
+/**
+ * @file intern.h
+ * @brief The intern module maps topic names to stable small integer IDs
+ *
+ * Publishers tend to reuse a fixed set of topics. Interning hashes the topic
+ * bytes once, splits them into levels once, and hands out an ID that the rest
+ * of the broker can compare and index with instead of the string. Entries are
+ * reference counted and evicted when the last reference is released, after
+ * which their ID may be reused.
+ */
+
+#ifndef INTERN_H_
+#define INTERN_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Value never handed out as a topic ID */
+#define INTERN_INVALID_ID 0
+
+/**
+ * @brief Interned topic name
+ */
+struct topic_entry {
+	uint32_t id;                /**< Stable topic ID */
+	uint32_t hash;              /**< Hash of the topic bytes */
+	uint64_t serial;            /**< Never reused, unlike the ID */
+	atomic_uint refcount;       /**< Number of outstanding references */
+	unsigned short len;         /**< Length of the topic */
+	unsigned short nlevels;     /**< Number of topic levels */
+	uint32_t *levels;           /**< Start offset of each level, followed
+				         by len + 1 as end sentinel */
+	unsigned char *topic;       /**< NUL terminated topic bytes */
+	struct topic_entry *next;   /**< Next entry in the hash bucket */
+};
+
+/**
+ * @brief Concurrent topic intern table
+ *
+ * Lookups of already interned topics only take the read lock, inserts and
+ * evictions take the write lock.
+ */
+struct intern_table {
+	pthread_rwlock_t lock;          /**< Protects buckets and ids */
+	struct topic_entry **buckets;   /**< Hash buckets */
+	size_t nbuckets;                /**< Number of buckets, power of two */
+	size_t count;                   /**< Number of interned topics */
+	struct topic_entry **ids;       /**< Entries indexed by ID */
+	size_t ids_cap;                 /**< Allocated ID slots */
+	uint32_t *free_ids;             /**< Stack of released IDs */
+	size_t nfree;                   /**< IDs on the free stack */
+	uint32_t next_id;               /**< Next never used ID */
+	uint64_t next_serial;           /**< Next entry serial */
+};
+
+/**
+ * @brief Initializes an empty intern table
+ *
+ * @param[out] table Table to initialize
+ * @return 0 on success, -1 on allocation failure
+ */
+int intern_init(struct intern_table *);
+
+/**
+ * @brief Interns a topic and takes a reference on it
+ *
+ * @param[in,out] table Intern table
+ * @param[in] topic Topic bytes, need not be NUL terminated
+ * @param[in] len Length of the topic
+ * @return Topic ID, INTERN_INVALID_ID on allocation failure
+ */
+uint32_t intern_acquire(struct intern_table *, const unsigned char *,
+			unsigned short);
+
+/**
+ * @brief Takes another reference on an already interned topic
+ *
+ * @param[in,out] table Intern table
+ * @param[in] id Topic ID the caller holds a reference on
+ */
+void intern_retain(struct intern_table *, uint32_t);
+
+/**
+ * @brief Releases a reference, evicting the topic when it was the last one
+ *
+ * @param[in,out] table Intern table
+ * @param[in] id Topic ID
+ */
+void intern_release(struct intern_table *, uint32_t);
+
+/**
+ * @brief Returns the entry of an interned topic
+ *
+ * The entry stays valid as long as the caller holds a reference on the ID.
+ *
+ * @param[in] table Intern table
+ * @param[in] id Topic ID
+ * @return Topic entry, NULL if the ID is not interned
+ */
+const struct topic_entry *intern_lookup(struct intern_table *, uint32_t);
+
+/**
+ * @brief Returns a level of an interned topic
+ *
+ * @param[in] entry Topic entry
+ * @param[in] level Level index, must be lower than entry->nlevels
+ * @param[out] len Length of the level
+ * @return Pointer to the first byte of the level inside entry->topic
+ */
+const unsigned char *intern_level(const struct topic_entry *, unsigned short,
+				  unsigned short *);
+
+/**
+ * @brief Releases every entry and the memory held by the table
+ *
+ * @param[in,out] table Table to destroy
+ */
+void intern_destroy(struct intern_table *);
+
+#endif // INTERN_H_
@@ -0,0 +1,77 @@
+/**
+ * @file matchcache.h
+ * @brief The match cache module memoizes subscription trie lookups per topic
+ *
+ * A bounded, direct-mapped cache from interned topic ID to the deduplicated
+ * subscriber set of that topic. Each entry keeps the trie path of the walk
+ * that produced it, and is reused as long as no generation read on that path
+ * changed. A subscription change therefore only invalidates the entries whose
+ * walk went through the changed node, a new literal level only those that
+ * looked up a level of the same hash below its parent, and the check costs
+ * one load and compare per recorded generation instead of a full trie walk.
+ *
+ * The cache follows the threading rules of the trie it fronts.
+ */
+
+#ifndef MATCHCACHE_H_
+#define MATCHCACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "intern.h"
+#include "trie.h"
+
+/**
+ * @brief Cached match result of one topic
+ */
+struct match_cache_entry {
+	uint64_t serial;          /**< Serial of the interned topic, 0 if the
+				       slot is empty */
+	struct trie_path path;    /**< Generations read by the walk */
+	struct sub_set subs;      /**< Resolved subscribers */
+};
+
+/**
+ * @brief Bounded topic to subscribers cache
+ */
+struct match_cache {
+	struct match_cache_entry *entries;  /**< Direct-mapped slots */
+	size_t cap;                         /**< Number of slots, power of two */
+	struct {
+		uint64_t hits;           /**< Lookups served from the cache */
+		uint64_t misses;         /**< Lookups on an empty or foreign slot */
+		uint64_t stale;          /**< Lookups on an invalidated entry */
+	} stats;                            /**< Lookup statistics */
+};
+
+/**
+ * @brief Initializes an empty cache
+ *
+ * @param[out] cache Cache to initialize
+ * @param[in] cap Number of slots, rounded up to a power of two
+ * @return 0 on success, -1 on allocation failure
+ */
+int match_cache_init(struct match_cache *, size_t);
+
+/**
+ * @brief Returns the subscribers of a topic, walking the trie only when the
+ *        cached result is missing or stale
+ *
+ * @param[in,out] cache Match cache
+ * @param[in] trie Subscription trie
+ * @param[in] topic Interned topic
+ * @return Subscriber set owned by the cache, valid until the next lookup,
+ *         NULL on allocation failure
+ */
+const struct sub_set *match_cache_lookup(struct match_cache *,
+					 const struct sub_trie *,
+					 const struct topic_entry *);
+
+/**
+ * @brief Releases the memory held by a cache
+ *
+ * @param[in,out] cache Cache to destroy
+ */
+void match_cache_destroy(struct match_cache *);
+
+#endif // MATCHCACHE_H_
@@ -231,6 +231,22 @@ int mqtt_encode_length(unsigned char *, size_t);
  */
 unsigned long long mqtt_decode_length(const unsigned char **);
 
+/**
+ * @brief Locates the topic of a PUBLISH frame in place, without allocating
+ *
+ * Lets ingress checks such as rate limiting run on a frame before it is
+ * unpacked or routed.
+ *
+ * @param[in] buf Buffer starting at the fixed header
+ * @param[in] len Number of bytes available in buf
+ * @param[out] topic Topic name inside buf
+ * @param[out] topiclen Length of the topic name
+ * @return Length of the whole frame, 0 if buf does not hold the topic yet,
+ *         -1 if the frame is not a well formed PUBLISH
+ */
+long mqtt_peek_publish(const unsigned char *, size_t, const unsigned char **,
+                       unsigned short *);
+
 /**
  * @brief Unmarshals an MQTT packet
  *
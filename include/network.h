@@ -0,0 +1,109 @@
+/**
+ * @file network.h
+ * @brief The network module defines socket utilities shared by the broker
+ */
+
+#ifndef NETWORK_H_
+#define NETWORK_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @brief Sets a socket file descriptor to non-blocking mode
+ *
+ * @param[in] fd Socket file descriptor
+ * @return 0 on success, -1 on failure
+ */
+int set_nonblocking(int);
+
+/**
+ * @brief Disables Nagle's algorithm on a TCP socket
+ *
+ * @param[in] fd Socket file descriptor
+ * @return 0 on success, -1 on failure
+ */
+int set_tcp_nodelay(int);
+
+/**
+ * @brief Creates a TCP socket bound to host:port and listening on it
+ *
+ * @param[in] host Address to bind to
+ * @param[in] port Port to bind to, "0" lets the kernel pick one
+ * @return Listening socket file descriptor, -1 on failure
+ */
+int make_listen(const char *, const char *);
+
+/**
+ * @brief Opens a TCP connection to host:port
+ *
+ * @param[in] host Remote address
+ * @param[in] port Remote port
+ * @return Connected socket file descriptor, -1 on failure
+ */
+int make_connection(const char *, const char *);
+
+/**
+ * @brief Creates a Unix domain stream socket bound to path and listening on it
+ *
+ * A socket file left at path by a previous run is removed first, but only
+ * if nothing accepts connections on it any more. Binding over a live
+ * listener fails with EADDRINUSE.
+ *
+ * @param[in] path Filesystem path of the socket
+ * @return Listening socket file descriptor, -1 on failure
+ */
+int make_unix_listen(const char *);
+
+/**
+ * @brief Opens a Unix domain stream connection to path
+ *
+ * @param[in] path Filesystem path of the socket
+ * @return Connected socket file descriptor, -1 on failure
+ */
+int make_unix_connection(const char *);
+
+/**
+ * @brief Sets the kernel send and receive buffer sizes of a socket
+ *
+ * Accepted TCP sockets inherit the sizes of their listener, which is also
+ * the only way to size the receive window they negotiate. Accepted Unix
+ * domain sockets do not inherit them. Set the sizes on every connected
+ * socket, accepted and client side alike.
+ *
+ * @param[in] fd Socket file descriptor
+ * @param[in] size Buffer size in bytes, 0 keeps the system default
+ * @return 0 on success, -1 on failure
+ */
+int set_socket_buffers(int, int);
+
+/**
+ * @brief Returns the local port a socket is bound to
+ *
+ * @param[in] fd Socket file descriptor
+ * @return Port in host byte order, -1 on failure
+ */
+int socket_port(int);
+
+/**
+ * @brief Sends a whole buffer, retrying on short writes
+ *
+ * @param[in] fd Socket file descriptor
+ * @param[in] buf Bytes to send
+ * @param[in] len Number of bytes to send
+ * @return Number of bytes sent, -1 on failure
+ */
+ssize_t send_bytes(int, const unsigned char *, size_t);
+
+/**
+ * @brief Receives exactly len bytes, retrying on short reads
+ *
+ * @param[in] fd Socket file descriptor
+ * @param[out] buf Buffer to receive into
+ * @param[in] len Number of bytes to receive
+ * @return Number of bytes received, 0 if the peer closed the connection,
+ *         -1 on failure
+ */
+ssize_t recv_bytes(int, unsigned char *, size_t);
+
+#endif // NETWORK_H_
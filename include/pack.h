@@ -14,6 +14,8 @@ uint32_t unpack_u32(const uint8_t **);
 uint8_t *unpack_bytes(const uint8_t **, size_t, uint8_t *);
 // Unpack a string prefixed by its length as a uint18 value
 uint16_t unpack_string16(uint8_t **buf, uint8_t **dest);
+// Point at a string prefixed by its length as a uint16 value, without copying
+uint16_t unpack_string16_view(const uint8_t **, const uint8_t **);
 // append a uint8_t -> bytes into the bytestring
 void pack_u8(uint8_t **, uint8_t);
 // append a uint16_t -> bytes into the bytestring
@@ -22,5 +24,9 @@ void pack_u16(uint8_t **, uint16_t);
 void pack_u32(uint8_t **, uint32_t);
 // append len bytes into the bytestring
 void pack_bytes(uint8_t **, uint8_t *);
+// append exactly len bytes into the bytestring, binary safe
+void pack_nbytes(uint8_t **, const uint8_t *, size_t);
+// append a string prefixed by its length as a uint16 value
+void pack_string16(uint8_t **, const uint8_t *, uint16_t);
 
 #endif // PACK_H_
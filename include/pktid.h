@@ -0,0 +1,104 @@
+/**
+ * @file pktid.h
+ * @brief The pktid module tracks the inbound QoS 2 packet IDs of a session
+ *
+ * A packet ID is added when the broker sends PUBREC and removed when the
+ * matching PUBREL arrives. A PUBLISH whose ID is still in the set is a
+ * duplicate and must not be delivered again.
+ *
+ * Most sessions have no or very few QoS 2 messages in flight, so up to
+ * PKTID_INLINE IDs are kept inside the set itself and nothing is allocated.
+ * Beyond that the IDs move to a small sorted array, searched in O(log n), and
+ * only a set of more than PKTID_SORTED_MAX IDs switches to a 65,536-bit
+ * bitmap with O(1) operations. Sets shrink back well below the size they
+ * grew at, so a session hovering around a boundary does not allocate and
+ * free on every PUBREC and PUBREL: a bitmap goes back to a sorted array at
+ * PKTID_SHRINK_SORTED IDs, and a sorted array back to the allocation free
+ * inline IDs at PKTID_SHRINK_INLINE.
+ */
+
+#ifndef PKTID_H_
+#define PKTID_H_
+
+#include <stdint.h>
+
+/** @name Packet ID Set Constants */
+/**@{*/
+/** Number of IDs stored without allocating */
+#define PKTID_INLINE 4
+/** Maximum number of IDs of the sorted array */
+#define PKTID_SORTED_MAX 64
+/** Number of IDs at which a sorted array goes back inline */
+#define PKTID_SHRINK_INLINE (PKTID_INLINE / 2)
+/** Number of IDs at which a bitmap goes back to a sorted array */
+#define PKTID_SHRINK_SORTED (PKTID_SORTED_MAX / 2)
+/** Number of 64-bit words of the bitmap, one bit per packet ID */
+#define PKTID_BITMAP_WORDS (65536 / 64)
+/**@}*/
+
+/**
+ * @brief Representations of a packet ID set
+ */
+enum pktid_mode {
+	PKTID_MODE_INLINE,   /**< IDs stored in the set itself */
+	PKTID_MODE_SORTED,   /**< IDs in an allocated sorted array */
+	PKTID_MODE_BITMAP    /**< One bit per packet ID */
+};
+
+/**
+ * @brief Set of packet IDs, 16 bytes while idle
+ */
+struct pktid_set {
+	union {
+		uint16_t ids[PKTID_INLINE];  /**< Inline IDs, first count used */
+		uint16_t *sorted;            /**< Sorted IDs, first count used */
+		uint64_t *bitmap;            /**< Bitmap of the IDs */
+	};
+	uint32_t count;      /**< Number of IDs in the set */
+	uint16_t cap;        /**< Allocated slots of the sorted array */
+	uint8_t mode;        /**< enum pktid_mode */
+};
+
+/**
+ * @brief Initializes an empty set
+ *
+ * @param[out] set Set to initialize
+ */
+void pktid_set_init(struct pktid_set *);
+
+/**
+ * @brief Adds a packet ID to the set
+ *
+ * @param[in,out] set Packet ID set
+ * @param[in] id Packet ID
+ * @return 1 if the ID was added, 0 if it was already present,
+ *         -1 on allocation failure
+ */
+int pktid_set_add(struct pktid_set *, uint16_t);
+
+/**
+ * @brief Checks whether a packet ID is in the set
+ *
+ * @param[in] set Packet ID set
+ * @param[in] id Packet ID
+ * @return 1 if present, 0 otherwise
+ */
+int pktid_set_contains(const struct pktid_set *, uint16_t);
+
+/**
+ * @brief Removes a packet ID from the set
+ *
+ * @param[in,out] set Packet ID set
+ * @param[in] id Packet ID
+ * @return 1 if the ID was removed, 0 if it was not present
+ */
+int pktid_set_remove(struct pktid_set *, uint16_t);
+
+/**
+ * @brief Empties the set and frees its allocation, if any
+ *
+ * @param[in,out] set Set to release
+ */
+void pktid_set_release(struct pktid_set *);
+
+#endif // PKTID_H_
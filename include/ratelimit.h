@@ -0,0 +1,190 @@
+/**
+ * @file ratelimit.h
+ * @brief The ratelimit module enforces token-bucket limits on ingress
+ *        PUBLISH traffic
+ *
+ * Limits on messages and bytes per second can be set per client ID, per
+ * username and per topic prefix. Each limited key has its own bucket, except
+ * that all connections of one username share that username's bucket and all
+ * publishers to a topic prefix share that prefix's bucket.
+ *
+ * ratelimit_publish is meant to run right after the PUBLISH header is
+ * decoded (see mqtt_peek_publish), before anything is unpacked, allocated or
+ * routed. A PUBLISH is never dropped: it is always charged and let through,
+ * and the returned delay tells the caller how long to stop reading from the
+ * socket (see conn_pause). The flood then backs up into the client's TCP
+ * window instead of the broker's routing budget.
+ */
+
+#ifndef RATELIMIT_H_
+#define RATELIMIT_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief What a limit is keyed on
+ */
+enum ratelimit_scope {
+	RATELIMIT_CLIENT,     /**< Client ID, one bucket per connection */
+	RATELIMIT_USERNAME,   /**< Username, shared by its connections */
+	RATELIMIT_TOPIC       /**< Topic prefix, shared by all publishers */
+};
+
+/**
+ * @brief Rates and bursts of a limit, a zero rate means unlimited
+ */
+struct rate_limit {
+	uint32_t msgs_per_sec;    /**< Sustained PUBLISH rate */
+	uint32_t msg_burst;       /**< PUBLISH packets allowed back to back */
+	uint32_t bytes_per_sec;   /**< Sustained byte rate */
+	uint32_t byte_burst;      /**< Bytes allowed back to back */
+};
+
+/**
+ * @brief State of a message bucket and a byte bucket
+ *
+ * Buckets are kept as the theoretical arrival time of the next unit (GCRA),
+ * which is equivalent to a token bucket but needs no refill step. Shared
+ * buckets are charged with compare-and-swap, so publishers only contend on
+ * the buckets they actually share.
+ */
+struct rate_bucket {
+	_Atomic uint64_t msgs_tat;    /**< Monotonic ns the message bucket is
+					   full at */
+	_Atomic uint64_t bytes_tat;   /**< Monotonic ns the byte bucket is full
+					   at */
+};
+
+/**
+ * @brief Limit configured for a key, or the default of a scope
+ */
+struct ratelimit_rule {
+	enum ratelimit_scope scope;    /**< What the key is matched against */
+	unsigned char *key;            /**< Exact key or prefix, NULL for the
+					    scope default */
+	uint16_t keylen;               /**< Length of the key */
+	struct rate_limit limit;       /**< Rates of the key */
+	struct rate_bucket bucket;     /**< Shared bucket of a topic prefix */
+	struct ratelimit_rule *next;   /**< Next rule in the hash chain */
+};
+
+/**
+ * @brief Shared bucket of a username
+ */
+struct ratelimit_user {
+	unsigned char *username;             /**< Username bytes */
+	uint16_t len;                        /**< Username length */
+	unsigned refcount;                   /**< Attached connections */
+	const struct rate_limit *limit;      /**< Limit of the username */
+	struct rate_bucket bucket;           /**< Shared bucket */
+	struct ratelimit_user *next;         /**< Next user in the hash chain */
+};
+
+/**
+ * @brief Limits of one connection, resolved once at CONNECT
+ */
+struct ratelimit_client {
+	const struct rate_limit *limit;   /**< Client limit, NULL if none */
+	struct rate_bucket bucket;        /**< Bucket of this connection */
+	struct ratelimit_user *user;      /**< Username bucket, NULL if none */
+};
+
+/**
+ * @brief Configured limits and the buckets shared between connections
+ */
+struct ratelimit {
+	pthread_mutex_t lock;              /**< Protects the username table */
+	struct ratelimit_rule **rules;     /**< Rule hash table by scope and key */
+	struct ratelimit_rule *defaults[RATELIMIT_TOPIC]; /**< Scope defaults */
+	uint16_t *prefix_lens;             /**< Distinct topic prefix lengths,
+					        ascending */
+	size_t nprefix_lens;               /**< Number of prefix lengths */
+	atomic_bool sealed;                /**< Set by the first attach, rules
+					        are fixed from then on */
+	struct ratelimit_user **users;     /**< Username hash table */
+	size_t nbuckets;                   /**< Size of the username table */
+};
+
+/**
+ * @brief Initializes a limiter without any limits
+ *
+ * @param[out] rl Limiter to initialize
+ * @return 0 on success, -1 on allocation failure
+ */
+int ratelimit_init(struct ratelimit *);
+
+/**
+ * @brief Adds or replaces the limit of a key
+ *
+ * Rules must be configured before connections are attached, once the first
+ * connection is attached the rules are fixed and connections keep pointers
+ * to them without taking any lock. A NULL key sets
+ * the default of the client or username scope. Topic rules always need a
+ * prefix, and a topic is limited by its longest matching prefix only.
+ * Prefixes match bytes, end them with '/' to match whole levels.
+ *
+ * @param[in,out] rl Limiter
+ * @param[in] scope What the key is matched against
+ * @param[in] key Client ID, username or topic prefix, NULL for the default
+ * @param[in] keylen Length of the key
+ * @param[in] limit Rates of the key
+ * @return 0 on success, -1 on allocation failure or invalid arguments, or
+ *         with errno set to EBUSY once a connection was attached
+ */
+int ratelimit_add(struct ratelimit *, enum ratelimit_scope,
+		  const unsigned char *, uint16_t, struct rate_limit);
+
+/**
+ * @brief Resolves the limits of a connection after CONNECT
+ *
+ * @param[in,out] rl Limiter
+ * @param[out] client Limits of the connection
+ * @param[in] client_id Client ID bytes
+ * @param[in] cid_len Client ID length
+ * @param[in] username Username bytes, NULL if no username was given
+ * @param[in] ulen Username length
+ * @return 0 on success, -1 on allocation failure
+ */
+int ratelimit_attach(struct ratelimit *, struct ratelimit_client *,
+		     const unsigned char *, size_t, const unsigned char *,
+		     size_t);
+
+/**
+ * @brief Releases the limits of a disconnected connection
+ *
+ * @param[in,out] rl Limiter
+ * @param[in,out] client Limits of the connection
+ */
+void ratelimit_detach(struct ratelimit *, struct ratelimit_client *);
+
+/**
+ * @brief Charges a PUBLISH to every bucket that applies to it
+ *
+ * Does not allocate and takes no lock. The topic rule is found with one
+ * hash probe per distinct prefix length, and the shared buckets are charged
+ * with compare-and-swap.
+ *
+ * @param[in,out] rl Limiter
+ * @param[in,out] client Limits of the publishing connection
+ * @param[in] topic Topic name
+ * @param[in] topiclen Length of the topic name
+ * @param[in] bytes Size of the whole PUBLISH frame
+ * @param[in] now Current CLOCK_MONOTONIC time in nanoseconds
+ * @return Nanoseconds to stop reading from the connection, 0 if within all
+ *         limits
+ */
+uint64_t ratelimit_publish(struct ratelimit *, struct ratelimit_client *,
+			   const unsigned char *, size_t, size_t, uint64_t);
+
+/**
+ * @brief Releases the memory held by a limiter
+ *
+ * @param[in,out] rl Limiter to destroy
+ */
+void ratelimit_destroy(struct ratelimit *);
+
+#endif // RATELIMIT_H_
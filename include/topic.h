@@ -0,0 +1,50 @@
+/**
+ * @file topic.h
+ * @brief The topic module defines MQTT topic name and topic filter utilities
+ */
+
+#ifndef TOPIC_H_
+#define TOPIC_H_
+
+#include <stddef.h>
+
+/** @name MQTT Topic Constants */
+/**@{*/
+/** Topic level separator */
+#define TOPIC_SEPARATOR '/'
+/** Single level wildcard */
+#define TOPIC_WILDCARD_ONE '+'
+/** Multi level wildcard */
+#define TOPIC_WILDCARD_ALL '#'
+/**@}*/
+
+/**
+ * @brief Checks whether a topic name matches a topic filter
+ *
+ * Both strings are length delimited and need not be NUL terminated, so they
+ * can point straight into a received packet.
+ *
+ * @param[in] filter Topic filter, may contain '+' and '#' wildcards
+ * @param[in] filterlen Length of the topic filter
+ * @param[in] topic Topic name
+ * @param[in] topiclen Length of the topic name
+ * @return 1 if the topic matches the filter, 0 otherwise
+ */
+int topic_match(const unsigned char *, size_t, const unsigned char *, size_t);
+
+/**
+ * @brief Checks whether a topic filter covers another topic filter
+ *
+ * Filter a covers filter b when every topic name matched by b is also matched
+ * by a, so b is redundant next to a in an aggregated subscription summary.
+ *
+ * @param[in] a Covering topic filter
+ * @param[in] alen Length of the covering topic filter
+ * @param[in] b Covered topic filter
+ * @param[in] blen Length of the covered topic filter
+ * @return 1 if a covers b, 0 otherwise
+ */
+int topic_filter_covers(const unsigned char *, size_t, const unsigned char *,
+			size_t);
+
+#endif // TOPIC_H_
@@ -0,0 +1,102 @@
+/**
+ * @file trace.h
+ * @brief The trace module defines per-stage latency tracepoints for the packet
+ *        pipeline
+ *
+ * Tracepoints are placed around each stage a packet goes through and feed a
+ * per-thread log2 histogram per stage and packet type, so recording never
+ * contends between threads. They are only compiled in when the broker is
+ * configured with -DCMQTT_TRACE=ON, otherwise TRACE_BEGIN and TRACE_END
+ * expand to nothing.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Stages of a packet's life
+ */
+enum trace_stage {
+	TRACE_READ,     /**< Socket read */
+	TRACE_DECODE,   /**< Frame decode */
+	TRACE_ROUTE,    /**< Subscription matching */
+	TRACE_ENCODE,   /**< Frame encode */
+	TRACE_WRITE,    /**< Socket write */
+	TRACE_STAGES    /**< Number of stages */
+};
+
+/** @name Trace Constants */
+/**@{*/
+/** Number of histogram buckets, bucket i counts durations below 2^i ns */
+#define TRACE_BUCKETS 40
+/** Number of packet type slots, indexed by enum packet_type */
+#define TRACE_TYPES 16
+/**@}*/
+
+/**
+ * @brief Latency histogram of one stage and packet type
+ */
+struct trace_histogram {
+	uint64_t count;                    /**< Number of samples */
+	uint64_t total_ns;                 /**< Sum of all samples */
+	uint64_t max_ns;                   /**< Largest sample */
+	uint64_t buckets[TRACE_BUCKETS];   /**< Log2 buckets */
+};
+
+#ifdef CMQTT_TRACE
+/** Starts timing a stage, declaring the timestamp variable */
+#define TRACE_BEGIN(var) uint64_t var = trace_now()
+/** Stops timing a stage and records the sample */
+#define TRACE_END(var, stage, type) \
+	trace_record((stage), (type), trace_now() - (var))
+#else
+#define TRACE_BEGIN(var)
+#define TRACE_END(var, stage, type)
+#endif
+
+/**
+ * @brief Returns a monotonic timestamp in nanoseconds
+ *
+ * @return Current CLOCK_MONOTONIC time
+ */
+uint64_t trace_now(void);
+
+/**
+ * @brief Records a sample in the calling thread's histogram
+ *
+ * @param[in] stage Pipeline stage
+ * @param[in] type Packet type, see enum packet_type
+ * @param[in] ns Duration in nanoseconds
+ */
+void trace_record(enum trace_stage, unsigned, uint64_t);
+
+/**
+ * @brief Sums the histograms of every thread for a stage and packet type
+ *
+ * @param[out] out Merged histogram
+ * @param[in] stage Pipeline stage
+ * @param[in] type Packet type, see enum packet_type
+ */
+void trace_snapshot(struct trace_histogram *, enum trace_stage, unsigned);
+
+/**
+ * @brief Estimates a percentile from a histogram
+ *
+ * @param[in] hist Histogram
+ * @param[in] p Percentile between 0 and 100
+ * @return Upper bound of the bucket holding the percentile, at most the
+ *         largest sample, in nanoseconds
+ */
+uint64_t trace_percentile(const struct trace_histogram *, double);
+
+/**
+ * @brief Prints count, mean, p50, p99 and max of every non empty histogram
+ *
+ * @param[in] fp Output stream
+ */
+void trace_dump(FILE *);
+
+#endif // TRACE_H_
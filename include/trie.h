@@ -0,0 +1,177 @@
+/**
+ * @file trie.h
+ * @brief The trie module defines the subscription trie used to route PUBLISH
+ *        messages to subscribers
+ *
+ * Every topic filter level is a node, with '+' and '#' kept apart from the
+ * literal children so a match walk never compares wildcards. Literal children
+ * are kept sorted and found by binary search.
+ *
+ * Generations record what could alter a match result. A node's own
+ * generation changes with its subscriber list and its wildcard children.
+ * Literal children are covered by a few extra generations per node, selected
+ * by a hash of the child's level, so adding or removing one only affects
+ * walks that looked up a level with the same hash. A walk can record the
+ * generations it read and later revalidate its result by comparing them,
+ * without walking again.
+ *
+ * The trie is not thread safe, callers serialize access. Nodes left without
+ * subscribers or children are freed on unsubscribe, which bumps a generation
+ * of their parent. A walk records a parent before anything below it and
+ * revalidation stops at the first change, so a stale path never reads a
+ * freed node.
+ */
+
+#ifndef TRIE_H_
+#define TRIE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Number of literal child generations per node, a power of two */
+#define TRIE_CHILD_GENS 8
+
+/**
+ * @brief Subscriber of a topic filter with the QoS it was granted
+ */
+struct subscription {
+	unsigned client;   /**< Subscriber identifier */
+	unsigned qos;      /**< Granted QoS level */
+};
+
+/**
+ * @brief Growable set of subscriptions
+ */
+struct sub_set {
+	struct subscription *subs;  /**< Array of subscriptions */
+	size_t len;                 /**< Number of subscriptions */
+	size_t cap;                 /**< Allocated slots */
+};
+
+/**
+ * @brief Level of a topic filter
+ */
+struct trie_node {
+	unsigned char *level;           /**< Level bytes */
+	unsigned short len;             /**< Length of the level */
+	struct trie_node **children;    /**< Literal children, sorted by length
+					     then bytes */
+	size_t nchildren;               /**< Number of literal children */
+	size_t cap;                     /**< Allocated child slots */
+	struct trie_node *one;          /**< '+' child */
+	struct trie_node *all;          /**< '#' child */
+	struct sub_set subs;            /**< Subscribers ending at this level */
+	uint64_t generation;            /**< Bumped when the subscribers or
+					     wildcard children change */
+	uint64_t child_gens[TRIE_CHILD_GENS]; /**< Bumped when a literal child
+						   of that level hash is added
+						   or removed */
+};
+
+/**
+ * @brief Generation read during a match walk and its value at the time
+ */
+struct trie_visit {
+	const uint64_t *generation;    /**< Generation of a visited node */
+	uint64_t seen;                 /**< Value seen by the walk */
+};
+
+/**
+ * @brief Growable record of the generations read by a match walk
+ */
+struct trie_path {
+	struct trie_visit *visits;  /**< Generations in walk order */
+	size_t len;                 /**< Number of recorded generations */
+	size_t cap;                 /**< Allocated slots */
+};
+
+/**
+ * @brief Subscription trie
+ */
+struct sub_trie {
+	struct trie_node root;  /**< Root node, has no level */
+	uint64_t clock;         /**< Source of node generations */
+	size_t nodes;           /**< Number of nodes below the root */
+};
+
+/**
+ * @brief Initializes an empty trie
+ *
+ * @param[out] trie Trie to initialize
+ */
+void trie_init(struct sub_trie *);
+
+/**
+ * @brief Adds a subscription, replacing the QoS of an existing one
+ *
+ * @param[in,out] trie Subscription trie
+ * @param[in] filter Topic filter
+ * @param[in] len Length of the topic filter
+ * @param[in] sub Subscription to add
+ * @return 0 on success, -1 on allocation failure
+ */
+int trie_subscribe(struct sub_trie *, const unsigned char *, size_t,
+		   struct subscription);
+
+/**
+ * @brief Removes a client's subscription to a topic filter
+ *
+ * Nodes of the filter that are left without subscribers and children are
+ * freed.
+ *
+ * @param[in,out] trie Subscription trie
+ * @param[in] filter Topic filter
+ * @param[in] len Length of the topic filter
+ * @param[in] client Subscriber identifier
+ * @return 1 if a subscription was removed, 0 otherwise
+ */
+int trie_unsubscribe(struct sub_trie *, const unsigned char *, size_t,
+		     unsigned);
+
+/**
+ * @brief Collects the deduplicated subscribers of a topic
+ *
+ * A client subscribed through several matching filters appears once, with
+ * the highest QoS it was granted.
+ *
+ * @param[in] trie Subscription trie
+ * @param[in] topic Topic name
+ * @param[in] len Length of the topic name
+ * @param[out] out Set receiving the subscribers, cleared first
+ * @param[out] path If not NULL, receives the generations read, cleared
+ *                  first
+ * @return 0 on success, -1 on allocation failure
+ */
+int trie_match(const struct sub_trie *, const unsigned char *, size_t,
+	       struct sub_set *, struct trie_path *);
+
+/**
+ * @brief Checks whether a recorded walk would still give the same result
+ *
+ * @param[in] path Generations recorded by trie_match
+ * @return 1 if no recorded generation changed since the walk, 0 otherwise
+ */
+int trie_path_valid(const struct trie_path *);
+
+/**
+ * @brief Releases the memory held by a subscription set
+ *
+ * @param[in,out] set Set to release
+ */
+void sub_set_release(struct sub_set *);
+
+/**
+ * @brief Releases the memory held by a path
+ *
+ * @param[in,out] path Path to release
+ */
+void trie_path_release(struct trie_path *);
+
+/**
+ * @brief Releases every node of a trie
+ *
+ * @param[in,out] trie Trie to destroy
+ */
+void trie_destroy(struct sub_trie *);
+
+#endif // TRIE_H_
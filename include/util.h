@@ -0,0 +1,65 @@
+/**
+ * @file util.h
+ * @brief Small helpers shared by the broker modules
+ */
+
+#ifndef UTIL_H_
+#define UTIL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Offset basis of the 32-bit FNV-1a hash */
+#define FNV1A_INIT 2166136261u
+
+/**
+ * @brief Continues a 32-bit FNV-1a hash over more bytes
+ *
+ * Hashing a string in pieces gives the same value as hashing it at once,
+ * which lets a caller hash every prefix of a string in a single pass.
+ *
+ * @param[in] hash Hash of the bytes so far, FNV1A_INIT to start
+ * @param[in] bytes Bytes to add
+ * @param[in] len Number of bytes
+ * @return Hash value
+ */
+static inline uint32_t fnv1a_update(uint32_t hash, const unsigned char *bytes,
+				    size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * @brief 32-bit FNV-1a hash of a byte string
+ *
+ * Used for hash tables keyed by topics and usernames, and as the record
+ * checksum of the write-ahead log, whose on-disk format depends on it.
+ *
+ * @param[in] bytes Bytes to hash
+ * @param[in] len Number of bytes
+ * @return Hash value
+ */
+static inline uint32_t fnv1a(const unsigned char *bytes, size_t len)
+{
+	return fnv1a_update(FNV1A_INIT, bytes, len);
+}
+
+/**
+ * @brief Returns the CLOCK_MONOTONIC time in nanoseconds
+ *
+ * @return Monotonic timestamp
+ */
+uint64_t monotonic_ns(void);
+
+/**
+ * @brief Returns the CLOCK_MONOTONIC time in milliseconds
+ *
+ * @return Monotonic timestamp
+ */
+uint64_t monotonic_ms(void);
+
+#endif // UTIL_H_
@@ -0,0 +1,144 @@
+/**
+ * @file wal.h
+ * @brief The WAL module defines a group-commit write-ahead log for QoS 1/2
+ *        messages bound for persistent sessions
+ *
+ * Appending a record only copies it into an in-memory batch. A dedicated
+ * writer thread collects every record appended within the commit window,
+ * writes them with a single write and a single fdatasync, and only then
+ * reports each record as durable. The PUBACK or PUBREC for a message must be
+ * sent from its durable callback, never from the append site.
+ *
+ * A failed write or fdatasync is final. The records of that batch, and of
+ * any batch behind it, are reported as failed, later appends are refused and
+ * fdatasync is never retried: after a failed sync the kernel may already
+ * have dropped the dirty pages, so a retry that succeeds proves nothing.
+ *
+ * On disk every record is laid out as:
+ *
+ *     u32 body length | u32 checksum | u8 header | u16 pkt_id
+ *                     | string16 topic | u32 payload length | payload
+ */
+
+#ifndef WAL_H_
+#define WAL_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mqtt.h"
+
+/** @name WAL Constants */
+/**@{*/
+/** Default commit window in microseconds */
+#define WAL_DEFAULT_WINDOW_US 2000
+/** Batch size that triggers a commit before the window expires */
+#define WAL_MAX_BATCH (4 * 1024 * 1024)
+/**@}*/
+
+/**
+ * @brief Callback invoked once a record is durable on disk, or will never be
+ *
+ * Runs on the writer thread, so it should only hand the acknowledgment back
+ * to the thread owning the connection, not send it itself. A record that
+ * failed must not be acknowledged, the client then retransmits it.
+ *
+ * @param[in] seq Sequence number returned by wal_append
+ * @param[in] error 0 if the record is durable, otherwise the errno of the
+ *            failed commit
+ * @param[in] arg User supplied argument
+ */
+typedef void (*wal_durable_cb)(uint64_t, int, void *);
+
+/**
+ * @brief Callback invoked for every record found by wal_replay
+ *
+ * @param[in] pkt Logged PUBLISH packet, only valid during the call
+ * @param[in] arg User supplied argument
+ */
+typedef void (*wal_replay_cb)(const struct mqtt_publish *, void *);
+
+/**
+ * @brief Records collected for one group commit
+ */
+struct wal_batch {
+	unsigned char *buf;       /**< Encoded records */
+	size_t len;               /**< Bytes used in buf */
+	size_t cap;               /**< Bytes allocated in buf */
+	struct {
+		wal_durable_cb cb;  /**< Durable callback */
+		void *arg;          /**< Callback argument */
+		uint64_t seq;       /**< Record sequence number */
+	} *waiters;               /**< Records waiting for the commit */
+	size_t nwaiters;          /**< Number of waiters */
+	size_t wcap;              /**< Allocated waiter slots */
+};
+
+/**
+ * @brief Write-ahead log handle
+ */
+struct wal {
+	int fd;                     /**< Log file descriptor */
+	unsigned long window_us;    /**< Commit window in microseconds */
+	pthread_t writer;           /**< Writer thread */
+	pthread_mutex_t lock;       /**< Protects everything below */
+	pthread_cond_t cond;        /**< Signals new records or shutdown */
+	int running;                /**< Cleared by wal_close */
+	int error;                  /**< errno of the failed commit, 0 if none */
+	uint64_t next_seq;          /**< Sequence of the next append */
+	struct wal_batch active;    /**< Batch receiving appends */
+	struct wal_batch flushing;  /**< Batch owned by the writer */
+	struct {
+		uint64_t commits;   /**< Number of fdatasync calls */
+		uint64_t records;   /**< Records made durable */
+		uint64_t bytes;     /**< Bytes made durable */
+	} stats;                    /**< Commit statistics */
+};
+
+/**
+ * @brief Opens a log for appending and starts its writer thread
+ *
+ * @param[out] wal Log handle to initialize
+ * @param[in] path Path of the log file, created if missing
+ * @param[in] window_us Commit window in microseconds, 0 commits as soon as
+ *            the writer is free
+ * @return 0 on success, -1 on failure
+ */
+int wal_open(struct wal *, const char *, unsigned long);
+
+/**
+ * @brief Appends a PUBLISH to the log without waiting for the disk
+ *
+ * @param[in,out] wal Log handle
+ * @param[in] pkt PUBLISH packet to log
+ * @param[in] cb Callback invoked once the record is durable
+ * @param[in] arg User supplied argument passed to cb
+ * @return Sequence number of the record, 0 on allocation failure or once a
+ *         commit has failed
+ */
+uint64_t wal_append(struct wal *, const struct mqtt_publish *, wal_durable_cb,
+		    void *);
+
+/**
+ * @brief Commits pending records, stops the writer thread and closes the log
+ *
+ * @param[in,out] wal Log handle
+ * @return 0 on success, -1 if any commit failed
+ */
+int wal_close(struct wal *);
+
+/**
+ * @brief Reads back every intact record of a log
+ *
+ * Reading stops at the first truncated or corrupted record, which is what a
+ * crash in the middle of a commit leaves behind. A record whose topic and
+ * payload lengths do not add up to its body counts as corrupted.
+ *
+ * @param[in] path Path of the log file
+ * @param[in] cb Callback invoked for each record
+ * @param[in] arg User supplied argument passed to cb
+ * @return Number of records replayed, -1 on failure
+ */
+long wal_replay(const char *, wal_replay_cb, void *);
+
+#endif // WAL_H_
@@ -0,0 +1,145 @@
+/**
+ * @file zerocopy.h
+ * @brief The zerocopy module defines the MSG_ZEROCOPY send path for large
+ *        PUBLISH payloads
+ *
+ * A payload fanned out to many subscribers is wrapped once in a reference
+ * counted zc_buf. Payloads at or above the socket's threshold are sent with
+ * MSG_ZEROCOPY: the kernel transmits straight from the buffer, so every
+ * pending send holds a reference until the matching completion is read from
+ * the socket error queue with zc_reap. Smaller payloads, and sockets or
+ * kernels without SO_ZEROCOPY, take the regular copying path.
+ */
+
+#ifndef ZEROCOPY_H_
+#define ZEROCOPY_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/** Default payload size from which MSG_ZEROCOPY is used */
+#define ZC_DEFAULT_THRESHOLD (16 * 1024)
+
+/**
+ * @brief Reference counted payload buffer
+ */
+struct zc_buf {
+	atomic_uint refcount;   /**< Holders, including pending sends */
+	size_t len;             /**< Payload length */
+	unsigned char data[];   /**< Payload bytes */
+};
+
+/**
+ * @brief Byte counters of a zerocopy socket
+ */
+struct zc_stats {
+	uint64_t copied_bytes;     /**< Bytes the kernel copied, including
+				        zerocopy sends it fell back on */
+	uint64_t zerocopy_bytes;   /**< Bytes sent without a copy */
+	uint64_t completions;      /**< Completion notifications read */
+};
+
+/**
+ * @brief Socket with a zerocopy send path
+ */
+struct zc_socket {
+	int fd;               /**< Connected stream socket */
+	int enabled;          /**< Non zero if SO_ZEROCOPY was accepted */
+	size_t threshold;     /**< Minimum payload size for MSG_ZEROCOPY */
+	uint32_t next_seq;    /**< Kernel notification ID of the next send */
+	struct {
+		uint32_t seq;        /**< Notification ID */
+		size_t len;          /**< Payload bytes covered */
+		struct zc_buf *buf;  /**< Pinned payload */
+	} *pending;           /**< Ring of sends awaiting completion */
+	size_t head;          /**< First pending slot */
+	size_t npending;      /**< Number of pending sends */
+	size_t cap;           /**< Allocated pending slots */
+	struct zc_stats stats;  /**< Byte counters */
+};
+
+/**
+ * @brief Allocates a payload buffer holding one reference
+ *
+ * @param[in] data Payload bytes to copy in
+ * @param[in] len Payload length
+ * @return New buffer, NULL on allocation failure
+ */
+struct zc_buf *zc_buf_new(const unsigned char *, size_t);
+
+/**
+ * @brief Takes a reference on a payload buffer
+ *
+ * @param[in,out] buf Payload buffer
+ * @return buf
+ */
+struct zc_buf *zc_buf_get(struct zc_buf *);
+
+/**
+ * @brief Drops a reference, freeing the buffer with the last one
+ *
+ * @param[in,out] buf Payload buffer
+ */
+void zc_buf_put(struct zc_buf *);
+
+/**
+ * @brief Sets up the zerocopy send path on a connected socket
+ *
+ * @param[out] zs Zerocopy socket to initialize
+ * @param[in] fd Connected stream socket
+ * @param[in] threshold Minimum payload size for MSG_ZEROCOPY
+ * @return 0 on success, zerocopy may still be disabled if unsupported
+ */
+int zc_socket_init(struct zc_socket *, int, size_t);
+
+/**
+ * @brief Sends a packet made of a small header and a shared payload
+ *
+ * The header, e.g. the PUBLISH fixed header and topic, is always copied.
+ * The payload is sent with MSG_ZEROCOPY when it reaches the threshold, in
+ * which case a reference is held until its completion is reaped.
+ *
+ * On a non-blocking socket the frame may go out over several calls. Pass
+ * the number of frame bytes already sent as offset, starting at 0, and add
+ * each return value to it until the whole frame is sent. The offset belongs
+ * to the caller, since one payload is shared by many connections.
+ *
+ * @param[in,out] zs Zerocopy socket
+ * @param[in] hdr Header bytes
+ * @param[in] hdrlen Header length
+ * @param[in] payload Shared payload
+ * @param[in] offset Bytes of header and payload already sent
+ * @return Number of bytes sent by this call, which may be short, -1 if
+ *         nothing could be sent (errno is EAGAIN if the socket would block)
+ */
+ssize_t zc_send(struct zc_socket *, const unsigned char *, size_t,
+		struct zc_buf *, size_t);
+
+/**
+ * @brief Reads pending completion notifications without blocking and
+ *        releases the payloads they cover
+ *
+ * @param[in,out] zs Zerocopy socket
+ * @return Number of sends completed, -1 on failure
+ */
+int zc_reap(struct zc_socket *);
+
+/**
+ * @brief Frees the pending send ring once every completion is reaped
+ *
+ * Closing the socket does not stop the kernel from reading a payload that
+ * is still queued or being retransmitted, only a completion does. Pending
+ * completions are reaped first. If sends are still outstanding afterwards,
+ * nothing is freed and their payloads stay pinned: keep the socket open,
+ * wait for its error queue to become readable (POLLERR) and call this
+ * again. The socket may only be closed after this returned 0.
+ *
+ * @param[in,out] zs Zerocopy socket
+ * @return 0 once nothing is pending, -1 with errno set to EBUSY while
+ *         sends are outstanding, or to the error of zc_reap
+ */
+int zc_socket_release(struct zc_socket *);
+
+#endif // ZEROCOPY_H_
@@ -0,0 +1,336 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/auth.h"
+#include "../include/util.h"
+
+/**
+ * @file auth.c
+ * @brief Implementation of the credential verification pool and cache
+ *
+ * Cache keys are two SipHash-2-4 tags of the length-prefixed username and
+ * password under a random per-process key, so the cache never holds a
+ * password or a hash that could be checked offline, and telling two
+ * credentials apart does not rely on a 64-bit hash alone. Only successful
+ * verifications are cached. A changed password therefore keeps working
+ * until its entry expires, which is what the TTL bounds.
+ */
+
+/**
+ * @brief Overwrites a buffer in a way the compiler cannot drop before free
+ */
+static void wipe(unsigned char *buf, size_t len)
+{
+	volatile unsigned char *p = buf;
+	while (len--)
+		*p++ = 0;
+}
+
+/** @name SipHash-2-4 */
+/**@{*/
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND                                                        \
+	do {                                                            \
+		v0 += v1;                                               \
+		v1 = ROTL(v1, 13);                                      \
+		v1 ^= v0;                                               \
+		v0 = ROTL(v0, 32);                                      \
+		v2 += v3;                                               \
+		v3 = ROTL(v3, 16);                                      \
+		v3 ^= v2;                                               \
+		v0 += v3;                                               \
+		v3 = ROTL(v3, 21);                                      \
+		v3 ^= v0;                                               \
+		v2 += v1;                                               \
+		v1 = ROTL(v1, 17);                                      \
+		v1 ^= v2;                                               \
+		v2 = ROTL(v2, 32);                                      \
+	} while (0)
+
+static uint64_t load_le64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static uint64_t siphash(uint64_t k0, uint64_t k1, const unsigned char *in,
+			size_t len)
+{
+	uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+	const unsigned char *end = in + len - (len % 8);
+	uint64_t m;
+
+	for (; in != end; in += 8) {
+		m = load_le64(in);
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	m = (uint64_t)len << 56;
+	for (int i = len % 8 - 1; i >= 0; i--)
+		m |= (uint64_t)in[i] << (8 * i);
+	v3 ^= m;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= m;
+
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+/**@}*/
+
+/** @name Credential cache */
+/**@{*/
+static int cache_init(struct auth_cache *cache, size_t cap,
+		      unsigned long ttl_ms)
+{
+	memset(cache, 0, sizeof(*cache));
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->ttl_ns = (uint64_t)ttl_ms * 1000000;
+	cache->now = monotonic_ns;
+
+	int fd = open("/dev/urandom", O_RDONLY);
+	if (fd == -1)
+		return -1;
+	ssize_t n = read(fd, cache->secret, sizeof(cache->secret));
+	close(fd);
+	if (n != sizeof(cache->secret))
+		return -1;
+
+	if (cap == 0)
+		return 0;
+	size_t slots = 1;
+	while (slots < cap)
+		slots *= 2;
+	cache->entries = calloc(slots, sizeof(*cache->entries));
+	if (!cache->entries)
+		return -1;
+	cache->cap = slots;
+	return 0;
+}
+
+/**
+ * @brief Computes the cache key of a username and password
+ */
+static int cache_key(const struct auth_cache *cache,
+		     const unsigned char *username, size_t ulen,
+		     const unsigned char *password, size_t plen,
+		     uint64_t key[2])
+{
+	// Length prefix keeps ("ab", "c") and ("a", "bc") apart
+	size_t len = sizeof(uint64_t) + ulen + plen;
+	unsigned char *msg = malloc(len);
+	if (!msg)
+		return -1;
+	uint64_t prefix = ulen;
+	memcpy(msg, &prefix, sizeof(prefix));
+	memcpy(msg + sizeof(prefix), username, ulen);
+	memcpy(msg + sizeof(prefix) + ulen, password, plen);
+
+	key[0] = siphash(cache->secret[0], cache->secret[1], msg, len);
+	key[1] = siphash(cache->secret[1], ~cache->secret[0], msg, len);
+	wipe(msg, len);
+	free(msg);
+	return 0;
+}
+
+static int cache_lookup(struct auth_cache *cache, const uint64_t key[2])
+{
+	if (cache->cap == 0)
+		return 0;
+	int hit = 0;
+	pthread_mutex_lock(&cache->lock);
+	size_t slot = key[0] & (cache->cap - 1);
+	if (cache->entries[slot].key[0] == key[0] &&
+	    cache->entries[slot].key[1] == key[1] &&
+	    cache->entries[slot].expires > cache->now())
+		hit = 1;
+	if (hit)
+		cache->hits++;
+	else
+		cache->misses++;
+	pthread_mutex_unlock(&cache->lock);
+	return hit;
+}
+
+static void cache_insert(struct auth_cache *cache, const uint64_t key[2])
+{
+	if (cache->cap == 0)
+		return;
+	pthread_mutex_lock(&cache->lock);
+	size_t slot = key[0] & (cache->cap - 1);
+	cache->entries[slot].key[0] = key[0];
+	cache->entries[slot].key[1] = key[1];
+	cache->entries[slot].expires = cache->now() + cache->ttl_ns;
+	pthread_mutex_unlock(&cache->lock);
+}
+/**@}*/
+
+/** @name Worker pool */
+/**@{*/
+static void job_free(struct auth_job *job)
+{
+	if (job->password)
+		wipe(job->password, job->plen);
+	free(job->password);
+	free(job->username);
+	free(job);
+}
+
+static void *worker_loop(void *arg)
+{
+	struct auth_pool *pool = arg;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->running && !pool->head)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		struct auth_job *job = pool->head;
+		if (!job) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		pool->head = job->next;
+		if (!pool->head)
+			pool->tail = NULL;
+		pool->queued--;
+		pthread_mutex_unlock(&pool->lock);
+
+		int ok = pool->verify(job->username, job->ulen, job->password,
+				      job->plen, pool->verify_arg) == 1;
+		if (ok)
+			cache_insert(&pool->cache, job->key);
+		job->cb(ok, job->arg);
+		job_free(job);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Lets the workers drain the queue and joins them
+ */
+static void stop_workers(struct auth_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->running = 0;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (size_t i = 0; i < pool->nworkers; i++)
+		pthread_join(pool->workers[i], NULL);
+}
+
+int auth_pool_init(struct auth_pool *pool, size_t nworkers,
+		   auth_verify_fn verify, void *arg, size_t max_queued,
+		   size_t cache_cap, unsigned long ttl_ms)
+{
+	memset(pool, 0, sizeof(*pool));
+	if (nworkers == 0)
+		return -1;
+	if (cache_init(&pool->cache, cache_cap, ttl_ms) == -1)
+		goto err_cache;
+	pool->max_queued = max_queued;
+	pool->verify = verify;
+	pool->verify_arg = arg;
+	pool->running = 1;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	pool->workers = calloc(nworkers, sizeof(*pool->workers));
+	if (!pool->workers)
+		goto err_workers;
+	for (; pool->nworkers < nworkers; pool->nworkers++)
+		if (pthread_create(&pool->workers[pool->nworkers], NULL,
+				   worker_loop, pool) != 0)
+			goto err_threads;
+	return 0;
+
+err_threads:
+	stop_workers(pool);
+	free(pool->workers);
+err_workers:
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->cond);
+err_cache:
+	free(pool->cache.entries);
+	pthread_mutex_destroy(&pool->cache.lock);
+	return -1;
+}
+
+static unsigned char *dup_bytes(const unsigned char *bytes, size_t len)
+{
+	unsigned char *copy = malloc(len ? len : 1);
+	if (copy)
+		memcpy(copy, bytes, len);
+	return copy;
+}
+
+int auth_submit(struct auth_pool *pool, const unsigned char *username,
+		size_t ulen, const unsigned char *password, size_t plen,
+		auth_done_cb cb, void *arg)
+{
+	uint64_t key[2];
+	if (cache_key(&pool->cache, username, ulen, password, plen, key) == -1)
+		return -1;
+	if (cache_lookup(&pool->cache, key))
+		return AUTH_CACHED;
+
+	struct auth_job *job = calloc(1, sizeof(*job));
+	if (!job)
+		return -1;
+	job->username = dup_bytes(username, ulen);
+	job->password = dup_bytes(password, plen);
+	job->ulen = ulen;
+	job->plen = plen;
+	if (!job->username || !job->password) {
+		job_free(job);
+		return -1;
+	}
+	job->key[0] = key[0];
+	job->key[1] = key[1];
+	job->cb = cb;
+	job->arg = arg;
+
+	pthread_mutex_lock(&pool->lock);
+	if (!pool->running || pool->queued >= pool->max_queued) {
+		pthread_mutex_unlock(&pool->lock);
+		job_free(job);
+		errno = EAGAIN;
+		return -1;
+	}
+	pool->queued++;
+	if (pool->tail)
+		pool->tail->next = job;
+	else
+		pool->head = job;
+	pool->tail = job;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	return AUTH_PENDING;
+}
+
+void auth_pool_destroy(struct auth_pool *pool)
+{
+	stop_workers(pool);
+	free(pool->workers);
+	free(pool->cache.entries);
+	pthread_mutex_destroy(&pool->cache.lock);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->cond);
+}
+/**@}*/
@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/cluster.h"
+#include "../include/network.h"
+#include "../include/pack.h"
+#include "../include/topic.h"
+#include "../include/trace.h"
+
+/**
+ * @file cluster.c
+ * @brief Implementation of broker-to-broker bridging over TCP
+ *
+ * Every node keeps one cluster_peer per remote node. Subscription changes are
+ * propagated by re-announcing the aggregated local summary, and PUBLISH
+ * messages are only queued for peers whose summary matches the topic. Queued
+ * records are accumulated in a single buffer and sent as one frame, so the
+ * per-message syscall cost is amortised over the whole batch.
+ */
+
+/** @name Summary handling */
+/**@{*/
+void cluster_summary_init(struct cluster_summary *summary)
+{
+	summary->len = 0;
+	summary->cap = 0;
+	summary->filters = NULL;
+}
+
+/**
+ * @brief Adds a topic filter to a summary, aggregating overlapping filters
+ *
+ * If an existing filter covers the new one nothing changes. Otherwise every
+ * existing filter covered by the new one is dropped before it is appended.
+ *
+ * @param[in,out] summary Summary to update
+ * @param[in] filter Topic filter
+ * @param[in] len Length of the topic filter
+ * @return 1 if the summary changed, 0 if the filter was already covered,
+ *         -1 on allocation failure
+ */
+int cluster_summary_add(struct cluster_summary *summary,
+			const unsigned char *filter, unsigned short len)
+{
+	size_t i, kept = 0;
+
+	for (i = 0; i < summary->len; i++)
+		if (topic_filter_covers(summary->filters[i].filter,
+					summary->filters[i].len, filter, len))
+			return 0;
+
+	// Allocate before dropping covered filters, a failure must not lose them
+	if (summary->len == summary->cap) {
+		size_t cap = summary->cap ? summary->cap * 2 : 8;
+		void *filters =
+			realloc(summary->filters, cap * sizeof(*summary->filters));
+		if (!filters)
+			return -1;
+		summary->filters = filters;
+		summary->cap = cap;
+	}
+
+	unsigned char *copy = malloc(len + 1);
+	if (!copy)
+		return -1;
+	memcpy(copy, filter, len);
+	copy[len] = '\0';
+
+	for (i = 0; i < summary->len; i++) {
+		if (topic_filter_covers(filter, len, summary->filters[i].filter,
+					summary->filters[i].len)) {
+			free(summary->filters[i].filter);
+			continue;
+		}
+		summary->filters[kept++] = summary->filters[i];
+	}
+	summary->filters[kept].len = len;
+	summary->filters[kept].filter = copy;
+	summary->len = kept + 1;
+	return 1;
+}
+
+int cluster_summary_match(const struct cluster_summary *summary,
+			  const unsigned char *topic, size_t len)
+{
+	for (size_t i = 0; i < summary->len; i++)
+		if (topic_match(summary->filters[i].filter,
+				summary->filters[i].len, topic, len))
+			return 1;
+	return 0;
+}
+
+void cluster_summary_clear(struct cluster_summary *summary)
+{
+	for (size_t i = 0; i < summary->len; i++)
+		free(summary->filters[i].filter);
+	free(summary->filters);
+	cluster_summary_init(summary);
+}
+/**@}*/
+
+/** @name Batch handling */
+/**@{*/
+void cluster_batch_init(struct cluster_batch *batch)
+{
+	batch->buf = NULL;
+	batch->len = CLUSTER_FRAME_HEADER_LEN;
+	batch->cap = 0;
+	batch->count = 0;
+}
+
+/**
+ * @brief Makes room for at least n more bytes in a batch
+ *
+ * @param[in,out] batch Batch to grow
+ * @param[in] n Number of bytes about to be appended
+ * @return Pointer to the first free byte, NULL on allocation failure or if
+ *         the batch already holds the maximum number of records
+ */
+static uint8_t *batch_reserve(struct cluster_batch *batch, size_t n)
+{
+	if (batch->count == UINT16_MAX)
+		return NULL;
+	if (batch->len + n > batch->cap) {
+		size_t cap = batch->cap ? batch->cap : CLUSTER_BATCH_SIZE;
+		while (cap < batch->len + n)
+			cap *= 2;
+		unsigned char *buf = realloc(batch->buf, cap);
+		if (!buf)
+			return NULL;
+		batch->buf = buf;
+		batch->cap = cap;
+	}
+	return batch->buf + batch->len;
+}
+
+int cluster_batch_add_summary(struct cluster_batch *batch,
+			      const struct cluster_summary *summary)
+{
+	size_t n = sizeof(uint8_t);
+	for (size_t i = 0; i < summary->len; i++)
+		n += sizeof(uint8_t) + sizeof(uint16_t) + summary->filters[i].len;
+	// A reset followed by a partial summary would make the peer drop
+	// interest, so the whole summary is reserved before anything is written
+	if (summary->len >= (size_t)(UINT16_MAX - batch->count))
+		return -1;
+	uint8_t *ptr = batch_reserve(batch, n);
+	if (!ptr)
+		return -1;
+
+	pack_u8(&ptr, CLUSTER_RESET);
+	for (size_t i = 0; i < summary->len; i++) {
+		pack_u8(&ptr, CLUSTER_INTEREST);
+		pack_string16(&ptr, summary->filters[i].filter,
+			      summary->filters[i].len);
+	}
+	batch->len += n;
+	batch->count += summary->len + 1;
+	return 0;
+}
+
+int cluster_batch_add_publish(struct cluster_batch *batch,
+			      const struct mqtt_publish *pkt)
+{
+	TRACE_BEGIN(start);
+	size_t n = 2 * sizeof(uint8_t) + 2 * sizeof(uint16_t) + pkt->topiclen +
+		   sizeof(uint32_t) + pkt->payloadlen;
+	uint8_t *ptr = batch_reserve(batch, n);
+	if (!ptr)
+		return -1;
+	pack_u8(&ptr, CLUSTER_PUBLISH);
+	pack_u8(&ptr, pkt->header.byte);
+	pack_u16(&ptr, pkt->pkt_id);
+	pack_string16(&ptr, pkt->topic, pkt->topiclen);
+	pack_u32(&ptr, pkt->payloadlen);
+	pack_nbytes(&ptr, pkt->payload, pkt->payloadlen);
+	batch->len += n;
+	batch->count++;
+	TRACE_END(start, TRACE_ENCODE, PUBLISH);
+	return 0;
+}
+
+void cluster_batch_release(struct cluster_batch *batch)
+{
+	free(batch->buf);
+	cluster_batch_init(batch);
+}
+/**@}*/
+
+/** @name Peer handling */
+/**@{*/
+void cluster_peer_init(struct cluster_peer *peer, int fd)
+{
+	peer->fd = fd;
+	cluster_summary_init(&peer->remote);
+	cluster_batch_init(&peer->out);
+}
+
+int cluster_peer_announce(struct cluster_peer *peer,
+			  const struct cluster_summary *summary)
+{
+	if (cluster_batch_add_summary(&peer->out, summary) == -1)
+		return -1;
+	return cluster_peer_flush(peer);
+}
+
+int cluster_peer_forward(struct cluster_peer *peer,
+			 const struct mqtt_publish *pkt)
+{
+	if (!cluster_summary_match(&peer->remote, pkt->topic, pkt->topiclen))
+		return 0;
+	if (cluster_batch_add_publish(&peer->out, pkt) == -1 &&
+	    (cluster_peer_flush(peer) == -1 ||
+	     cluster_batch_add_publish(&peer->out, pkt) == -1))
+		return -1;
+	if (peer->out.len >= CLUSTER_BATCH_SIZE &&
+	    cluster_peer_flush(peer) == -1)
+		return -1;
+	return 1;
+}
+
+int cluster_peer_flush(struct cluster_peer *peer)
+{
+	struct cluster_batch *batch = &peer->out;
+	if (batch->count == 0)
+		return 0;
+
+	uint8_t *ptr = batch->buf;
+	pack_u32(&ptr, batch->len - sizeof(uint32_t));
+	pack_u16(&ptr, batch->count);
+
+	TRACE_BEGIN(start);
+	ssize_t n = send_bytes(peer->fd, batch->buf, batch->len);
+	TRACE_END(start, TRACE_WRITE, PUBLISH);
+	batch->len = CLUSTER_FRAME_HEADER_LEN;
+	batch->count = 0;
+	return n == -1 ? -1 : 0;
+}
+
+/**
+ * @brief Decodes a frame body and applies its records to a peer
+ *
+ * Every field is bounds checked against the remaining body length before it
+ * is unpacked, a truncated or unknown record rejects the rest of the frame.
+ *
+ * @param[in,out] peer Peer the frame came from
+ * @param[in] buf Frame body, without the length prefix
+ * @param[in] len Length of the frame body
+ * @param[in] cb Callback for forwarded PUBLISH messages
+ * @param[in] arg User supplied argument passed to cb
+ * @return Number of records applied, -1 on malformed frame
+ */
+int cluster_decode(struct cluster_peer *peer, const unsigned char *buf,
+		   size_t len, cluster_publish_cb cb, void *arg)
+{
+	const uint8_t *ptr = buf;
+	const uint8_t *end = buf + len;
+
+	if (len < sizeof(uint16_t))
+		return -1;
+	uint16_t count = unpack_u16(&ptr);
+
+	for (uint16_t i = 0; i < count; i++) {
+		if (ptr >= end)
+			return -1;
+		TRACE_BEGIN(start);
+		uint8_t type = unpack_u8(&ptr);
+		switch (type) {
+		case CLUSTER_RESET:
+			cluster_summary_clear(&peer->remote);
+			break;
+		case CLUSTER_INTEREST: {
+			if (end - ptr < (long)sizeof(uint16_t))
+				return -1;
+			uint16_t flen = unpack_u16(&ptr);
+			if (end - ptr < flen)
+				return -1;
+			if (cluster_summary_add(&peer->remote, ptr, flen) == -1)
+				return -1;
+			ptr += flen;
+			break;
+		}
+		case CLUSTER_PUBLISH: {
+			struct mqtt_publish pkt;
+			if (end - ptr < (long)(sizeof(uint8_t) +
+					       2 * sizeof(uint16_t)))
+				return -1;
+			pkt.header.byte = unpack_u8(&ptr);
+			pkt.pkt_id = unpack_u16(&ptr);
+			pkt.topiclen = unpack_u16(&ptr);
+			if (end - ptr <
+			    (long)(pkt.topiclen + sizeof(uint32_t)))
+				return -1;
+			pkt.topic = (unsigned char *)ptr;
+			ptr += pkt.topiclen;
+			uint32_t plen = unpack_u32(&ptr);
+			if (plen > UINT16_MAX || end - ptr < (long)plen)
+				return -1;
+			pkt.payloadlen = plen;
+			pkt.payload = (unsigned char *)ptr;
+			ptr += plen;
+			TRACE_END(start, TRACE_DECODE, PUBLISH);
+			if (cb)
+				cb(peer, &pkt, arg);
+			break;
+		}
+		default:
+			return -1;
+		}
+	}
+	return ptr == end ? count : -1;
+}
+
+int cluster_peer_recv(struct cluster_peer *peer, cluster_publish_cb cb,
+		      void *arg)
+{
+	unsigned char hdr[sizeof(uint32_t)];
+	ssize_t n = recv_bytes(peer->fd, hdr, sizeof(hdr));
+	if (n <= 0)
+		return n;
+
+	const uint8_t *ptr = hdr;
+	uint32_t len = unpack_u32(&ptr);
+	if (len > CLUSTER_MAX_FRAME)
+		return -1;
+
+	unsigned char *body = malloc(len);
+	if (!body)
+		return -1;
+	TRACE_BEGIN(start);
+	n = recv_bytes(peer->fd, body, len);
+	TRACE_END(start, TRACE_READ, PUBLISH);
+	int rc = n <= 0 ? (int)n : cluster_decode(peer, body, len, cb, arg);
+	free(body);
+	return rc;
+}
+
+void cluster_peer_release(struct cluster_peer *peer)
+{
+	cluster_summary_clear(&peer->remote);
+	cluster_batch_release(&peer->out);
+}
+/**@}*/
@@ -0,0 +1,322 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "../include/connection.h"
+#include "../include/util.h"
+
+/**
+ * @file connection.c
+ * @brief Implementation of the compact connection state and buffer pool
+ *
+ * Each thread keeps a free list of standard sized buffers. Grown buffers,
+ * needed for frames larger than CONN_BUF_SIZE, are freed instead of pooled
+ * so one large PUBLISH does not pin its memory for good. A buffer may be
+ * released on a different thread than the one that acquired it, it then
+ * simply joins that thread's pool.
+ */
+
+_Static_assert(sizeof(struct connection) <= 64,
+	       "hot connection state must fit one cache line");
+
+/** Payload capacity of a pooled buffer */
+#define POOLED_CAP (CONN_BUF_SIZE - sizeof(struct conn_buf))
+
+_Static_assert(CONN_MAX_PACKET >= CONN_BUF_SIZE &&
+	       CONN_MAX_PACKET <= UINT32_MAX / 2,
+	       "CONN_MAX_PACKET must fit a pooled buffer and a uint32_t");
+
+static _Thread_local struct {
+	struct conn_buf *head;   /**< Idle buffers */
+	size_t idle;             /**< Length of the list */
+} pool;
+
+/** @name Buffer pool */
+/**@{*/
+static struct conn_buf *buf_acquire(void)
+{
+	struct conn_buf *buf = pool.head;
+	if (buf) {
+		pool.head = buf->next;
+		pool.idle--;
+	} else {
+		buf = malloc(CONN_BUF_SIZE);
+		if (!buf)
+			return NULL;
+		buf->cap = POOLED_CAP;
+	}
+	buf->next = NULL;
+	buf->start = buf->end = 0;
+	return buf;
+}
+
+static void buf_release(struct conn_buf *buf)
+{
+	if (buf->cap != POOLED_CAP || pool.idle >= CONN_POOL_MAX_IDLE) {
+		free(buf);
+		return;
+	}
+	buf->next = pool.head;
+	pool.head = buf;
+	pool.idle++;
+}
+
+/**
+ * @brief Makes room for len more bytes at the end of a buffer
+ *
+ * Unconsumed bytes are moved to the front first, the buffer is only grown
+ * when that is not enough, and never past CONN_MAX_PACKET.
+ */
+static struct conn_buf *buf_reserve(struct conn_buf *buf, size_t len)
+{
+	size_t used = buf->end - buf->start;
+	if (buf->cap - buf->end >= len)
+		return buf;
+	if (buf->start > 0) {
+		memmove(buf->data, buf->data + buf->start, used);
+		buf->start = 0;
+		buf->end = used;
+		if (buf->cap - used >= len)
+			return buf;
+	}
+	if (len > CONN_MAX_PACKET - used) {
+		errno = EMSGSIZE;
+		return NULL;
+	}
+	size_t cap = buf->cap;
+	while (cap < used + len)
+		cap *= 2;
+	if (cap > CONN_MAX_PACKET)
+		cap = CONN_MAX_PACKET;
+	struct conn_buf *grown = malloc(sizeof(*grown) + cap);
+	if (!grown)
+		return NULL;
+	memcpy(grown, buf, sizeof(*buf) + used);
+	grown->cap = cap;
+	buf_release(buf);
+	return grown;
+}
+
+size_t conn_pool_idle(void)
+{
+	return pool.idle;
+}
+
+void conn_pool_drain(void)
+{
+	while (pool.head) {
+		struct conn_buf *buf = pool.head;
+		pool.head = buf->next;
+		free(buf);
+	}
+	pool.idle = 0;
+}
+/**@}*/
+
+/** @name Connection state */
+/**@{*/
+void conn_init(struct connection *conn, int fd)
+{
+	memset(conn, 0, sizeof(*conn));
+	conn->fd = fd;
+	conn->state = CONN_NEW;
+	pktid_set_init(&conn->inflight);
+}
+
+int conn_set_info(struct connection *conn, const struct conn_params *params)
+{
+	int will = params->will_topic != NULL;
+	size_t cid_len = params->client_id_len;
+	size_t user_len = params->username ? params->username_len : 0;
+	size_t topic_len = will ? params->will_topic_len : 0;
+	size_t msg_len = will ? params->will_message_len : 0;
+	// A will needs a topic, and QoS 3 is malformed
+	if (will && (topic_len == 0 || params->will_qos > 2))
+		return -1;
+
+	struct conn_info *info =
+		malloc(sizeof(*info) + cid_len + user_len + topic_len + msg_len);
+	if (!info)
+		return -1;
+	info->client_id_len = cid_len;
+	info->username_len = user_len;
+	info->will_topic_len = topic_len;
+	info->will_message_len = msg_len;
+	info->will_qos = will ? params->will_qos : 0;
+	info->will_retain = will ? params->will_retain != 0 : 0;
+	unsigned char *ptr = info->data;
+	if (cid_len)
+		memcpy(ptr, params->client_id, cid_len);
+	ptr += cid_len;
+	if (user_len)
+		memcpy(ptr, params->username, user_len);
+	ptr += user_len;
+	if (topic_len)
+		memcpy(ptr, params->will_topic, topic_len);
+	ptr += topic_len;
+	if (msg_len)
+		memcpy(ptr, params->will_message, msg_len);
+
+	free(conn->info);
+	conn->info = info;
+	conn->keepalive = params->keepalive;
+	conn->clean_session = params->clean_session != 0;
+	conn->state = CONN_CONNECTED;
+	return 0;
+}
+
+const unsigned char *conn_client_id(const struct connection *conn,
+				    size_t *len)
+{
+	if (!conn->info)
+		return NULL;
+	*len = conn->info->client_id_len;
+	return conn->info->data;
+}
+
+const unsigned char *conn_username(const struct connection *conn,
+				   size_t *len)
+{
+	if (!conn->info || conn->info->username_len == 0)
+		return NULL;
+	*len = conn->info->username_len;
+	return conn->info->data + conn->info->client_id_len;
+}
+
+void conn_release(struct connection *conn)
+{
+	if (conn->rbuf)
+		buf_release(conn->rbuf);
+	if (conn->wbuf)
+		buf_release(conn->wbuf);
+	free(conn->info);
+	pktid_set_release(&conn->inflight);
+	conn->rbuf = conn->wbuf = NULL;
+	conn->info = NULL;
+}
+/**@}*/
+
+/** @name Connection I/O */
+/**@{*/
+/**
+ * @brief Returns the milliseconds left of a pause, 0 or less once it is over
+ *
+ * paused_until only keeps the low 32 bits of the time, the difference is
+ * wrap-safe because pauses are capped far below 2^31 ms.
+ */
+static int32_t pause_left(const struct connection *conn, uint64_t now)
+{
+	return (int32_t)(conn->paused_until - (uint32_t)now);
+}
+
+void conn_pause(struct connection *conn, uint64_t delay_ns)
+{
+	if (delay_ns == 0)
+		return;
+	// Round up so a short pause is not lost, 0 is reserved for not paused
+	uint64_t delay_ms = delay_ns / 1000000 + (delay_ns % 1000000 != 0);
+	if (delay_ms > CONN_MAX_PAUSE_MS)
+		delay_ms = CONN_MAX_PAUSE_MS;
+	uint32_t until = (uint32_t)(monotonic_ms() + delay_ms);
+	conn->paused_until = until ? until : 1;
+}
+
+uint64_t conn_paused_until(const struct connection *conn)
+{
+	if (!conn->paused_until)
+		return 0;
+	uint64_t now = monotonic_ms();
+	int32_t left = pause_left(conn, now);
+	return left > 0 ? now + left : 0;
+}
+
+ssize_t conn_recv(struct connection *conn)
+{
+	if (conn->paused_until) {
+		if (pause_left(conn, monotonic_ms()) > 0) {
+			errno = EBUSY;
+			return -1;
+		}
+		conn->paused_until = 0;
+	}
+	if (!conn->rbuf && !(conn->rbuf = buf_acquire()))
+		return -1;
+	// A full buffer holds a partial frame larger than the buffer
+	struct conn_buf *buf = buf_reserve(conn->rbuf, 1);
+	if (!buf)
+		return -1;
+	conn->rbuf = buf;
+
+	ssize_t n;
+	do {
+		n = recv(conn->fd, buf->data + buf->end, buf->cap - buf->end, 0);
+	} while (n == -1 && errno == EINTR);
+	if (n > 0)
+		buf->end += n;
+	if (buf->end == buf->start) {
+		int saved = errno;
+		buf_release(buf);
+		conn->rbuf = NULL;
+		errno = saved;
+	}
+	return n;
+}
+
+const unsigned char *conn_pending(const struct connection *conn, size_t *len)
+{
+	if (!conn->rbuf) {
+		*len = 0;
+		return NULL;
+	}
+	*len = conn->rbuf->end - conn->rbuf->start;
+	return conn->rbuf->data + conn->rbuf->start;
+}
+
+void conn_consume(struct connection *conn, size_t len)
+{
+	if (!conn->rbuf)
+		return;
+	conn->rbuf->start += len;
+	if (conn->rbuf->start >= conn->rbuf->end) {
+		buf_release(conn->rbuf);
+		conn->rbuf = NULL;
+	}
+}
+
+int conn_queue(struct connection *conn, const unsigned char *bytes,
+	       size_t len)
+{
+	if (!conn->wbuf && !(conn->wbuf = buf_acquire()))
+		return -1;
+	struct conn_buf *buf = buf_reserve(conn->wbuf, len);
+	if (!buf)
+		return -1;
+	conn->wbuf = buf;
+	memcpy(buf->data + buf->end, bytes, len);
+	buf->end += len;
+	return 0;
+}
+
+ssize_t conn_flush(struct connection *conn)
+{
+	struct conn_buf *buf = conn->wbuf;
+	if (!buf)
+		return 0;
+	while (buf->start < buf->end) {
+		ssize_t n = send(conn->fd, buf->data + buf->start,
+				 buf->end - buf->start, MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return buf->end - buf->start;
+			return -1;
+		}
+		buf->start += n;
+	}
+	buf_release(buf);
+	conn->wbuf = NULL;
+	return 0;
+}
+/**@}*/
@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/intern.h"
+#include "../include/topic.h"
+#include "../include/util.h"
+
+/**
+ * @file intern.c
+ * @brief Implementation of the concurrent topic intern table
+ *
+ * Entries live in a chained hash table keyed by topic bytes and in a dense
+ * array indexed by ID. The ID array makes ID to entry lookups a single load,
+ * and released IDs are recycled so the array stays as small as the number of
+ * live topics.
+ */
+
+/** Initial number of hash buckets */
+#define INITIAL_BUCKETS 1024
+
+int intern_init(struct intern_table *table)
+{
+	memset(table, 0, sizeof(*table));
+	table->buckets = calloc(INITIAL_BUCKETS, sizeof(*table->buckets));
+	if (!table->buckets)
+		return -1;
+	table->nbuckets = INITIAL_BUCKETS;
+	table->next_id = INTERN_INVALID_ID + 1;
+	pthread_rwlock_init(&table->lock, NULL);
+	return 0;
+}
+
+/**
+ * @brief Finds an entry by topic bytes, caller holds the lock
+ */
+static struct topic_entry *find(struct intern_table *table,
+				const unsigned char *topic,
+				unsigned short len, uint32_t hash)
+{
+	struct topic_entry *e = table->buckets[hash & (table->nbuckets - 1)];
+	for (; e; e = e->next)
+		if (e->hash == hash && e->len == len &&
+		    memcmp(e->topic, topic, len) == 0)
+			return e;
+	return NULL;
+}
+
+/**
+ * @brief Allocates an entry and splits its topic into levels
+ */
+static struct topic_entry *entry_new(const unsigned char *topic,
+				     unsigned short len, uint32_t hash)
+{
+	unsigned short nlevels = 1;
+	for (unsigned short i = 0; i < len; i++)
+		if (topic[i] == TOPIC_SEPARATOR)
+			nlevels++;
+
+	struct topic_entry *e = malloc(sizeof(*e));
+	if (!e)
+		return NULL;
+	e->topic = malloc(len + 1);
+	e->levels = malloc((nlevels + 1) * sizeof(*e->levels));
+	if (!e->topic || !e->levels) {
+		free(e->topic);
+		free(e->levels);
+		free(e);
+		return NULL;
+	}
+
+	memcpy(e->topic, topic, len);
+	e->topic[len] = '\0';
+	e->len = len;
+	e->hash = hash;
+	e->nlevels = nlevels;
+	atomic_init(&e->refcount, 1);
+
+	unsigned short level = 0;
+	e->levels[level++] = 0;
+	for (unsigned short i = 0; i < len; i++)
+		if (topic[i] == TOPIC_SEPARATOR)
+			e->levels[level++] = i + 1;
+	e->levels[level] = len + 1;
+	return e;
+}
+
+static void entry_free(struct topic_entry *e)
+{
+	free(e->topic);
+	free(e->levels);
+	free(e);
+}
+
+/**
+ * @brief Doubles the number of buckets and rehashes, caller holds the write
+ *        lock
+ */
+static void grow_buckets(struct intern_table *table)
+{
+	size_t nbuckets = table->nbuckets * 2;
+	struct topic_entry **buckets = calloc(nbuckets, sizeof(*buckets));
+	if (!buckets)
+		return;
+	for (size_t i = 0; i < table->nbuckets; i++) {
+		struct topic_entry *e = table->buckets[i], *next;
+		for (; e; e = next) {
+			next = e->next;
+			e->next = buckets[e->hash & (nbuckets - 1)];
+			buckets[e->hash & (nbuckets - 1)] = e;
+		}
+	}
+	free(table->buckets);
+	table->buckets = buckets;
+	table->nbuckets = nbuckets;
+}
+
+/**
+ * @brief Hands out an ID for a new entry, caller holds the write lock
+ */
+static uint32_t assign_id(struct intern_table *table, struct topic_entry *e)
+{
+	uint32_t id;
+	if (table->nfree > 0) {
+		id = table->free_ids[--table->nfree];
+	} else {
+		if (table->next_id >= table->ids_cap) {
+			size_t cap = table->ids_cap ? table->ids_cap * 2 : 1024;
+			void *ids = realloc(table->ids, cap * sizeof(*table->ids));
+			if (!ids)
+				return INTERN_INVALID_ID;
+			void *free_ids = realloc(table->free_ids,
+						 cap * sizeof(*table->free_ids));
+			if (!free_ids) {
+				table->ids = ids;
+				return INTERN_INVALID_ID;
+			}
+			table->ids = ids;
+			table->free_ids = free_ids;
+			table->ids_cap = cap;
+		}
+		id = table->next_id++;
+	}
+	table->ids[id] = e;
+	e->id = id;
+	e->serial = ++table->next_serial;
+	return id;
+}
+
+/**
+ * @brief Interns a topic and takes a reference on it
+ *
+ * The common case, a topic that is already interned, only takes the read
+ * lock and bumps the reference count.
+ *
+ * @param[in,out] table Intern table
+ * @param[in] topic Topic bytes, need not be NUL terminated
+ * @param[in] len Length of the topic
+ * @return Topic ID, INTERN_INVALID_ID on allocation failure
+ */
+uint32_t intern_acquire(struct intern_table *table,
+			const unsigned char *topic, unsigned short len)
+{
+	uint32_t hash = fnv1a(topic, len);
+	uint32_t id = INTERN_INVALID_ID;
+
+	pthread_rwlock_rdlock(&table->lock);
+	struct topic_entry *e = find(table, topic, len, hash);
+	if (e) {
+		atomic_fetch_add(&e->refcount, 1);
+		id = e->id;
+	}
+	pthread_rwlock_unlock(&table->lock);
+	if (id != INTERN_INVALID_ID)
+		return id;
+
+	pthread_rwlock_wrlock(&table->lock);
+	// Another thread may have interned it while the lock was dropped
+	if ((e = find(table, topic, len, hash))) {
+		atomic_fetch_add(&e->refcount, 1);
+		id = e->id;
+		goto out;
+	}
+	if (!(e = entry_new(topic, len, hash)))
+		goto out;
+	if ((id = assign_id(table, e)) == INTERN_INVALID_ID) {
+		entry_free(e);
+		goto out;
+	}
+	size_t bucket = hash & (table->nbuckets - 1);
+	e->next = table->buckets[bucket];
+	table->buckets[bucket] = e;
+	if (++table->count > table->nbuckets * 3 / 4)
+		grow_buckets(table);
+out:
+	pthread_rwlock_unlock(&table->lock);
+	return id;
+}
+
+void intern_retain(struct intern_table *table, uint32_t id)
+{
+	pthread_rwlock_rdlock(&table->lock);
+	atomic_fetch_add(&table->ids[id]->refcount, 1);
+	pthread_rwlock_unlock(&table->lock);
+}
+
+/**
+ * @brief Releases a reference, evicting the topic when it was the last one
+ *
+ * The count is dropped without the write lock. Whoever brings it to zero
+ * takes the write lock and evicts, unless a concurrent intern_acquire has
+ * revived the entry in the meantime. Between the two locks the entry may
+ * also be revived, released and evicted by another thread, and its ID (and
+ * even its address) reused by a new entry, so the entry is identified by
+ * its serial and not dereferenced until the ID slot is known to hold it.
+ *
+ * @param[in,out] table Intern table
+ * @param[in] id Topic ID
+ */
+void intern_release(struct intern_table *table, uint32_t id)
+{
+	pthread_rwlock_rdlock(&table->lock);
+	struct topic_entry *e = table->ids[id];
+	uint64_t serial = e->serial;
+	unsigned prev = atomic_fetch_sub(&e->refcount, 1);
+	pthread_rwlock_unlock(&table->lock);
+	if (prev != 1)
+		return;
+
+	pthread_rwlock_wrlock(&table->lock);
+	e = table->ids[id];
+	if (e && e->serial == serial && atomic_load(&e->refcount) == 0) {
+		struct topic_entry **pp =
+			&table->buckets[e->hash & (table->nbuckets - 1)];
+		while (*pp != e)
+			pp = &(*pp)->next;
+		*pp = e->next;
+		table->ids[id] = NULL;
+		table->free_ids[table->nfree++] = id;
+		table->count--;
+		entry_free(e);
+	}
+	pthread_rwlock_unlock(&table->lock);
+}
+
+const struct topic_entry *intern_lookup(struct intern_table *table,
+					uint32_t id)
+{
+	const struct topic_entry *e = NULL;
+	pthread_rwlock_rdlock(&table->lock);
+	if (id != INTERN_INVALID_ID && id < table->next_id)
+		e = table->ids[id];
+	pthread_rwlock_unlock(&table->lock);
+	return e;
+}
+
+const unsigned char *intern_level(const struct topic_entry *entry,
+				  unsigned short level, unsigned short *len)
+{
+	*len = entry->levels[level + 1] - entry->levels[level] - 1;
+	return entry->topic + entry->levels[level];
+}
+
+void intern_destroy(struct intern_table *table)
+{
+	for (size_t i = 0; i < table->nbuckets; i++) {
+		struct topic_entry *e = table->buckets[i], *next;
+		for (; e; e = next) {
+			next = e->next;
+			entry_free(e);
+		}
+	}
+	free(table->buckets);
+	free(table->ids);
+	free(table->free_ids);
+	pthread_rwlock_destroy(&table->lock);
+}
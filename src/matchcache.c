@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/matchcache.h"
+
+/**
+ * @file matchcache.c
+ * @brief Implementation of the subscription match cache
+ */
+
+int match_cache_init(struct match_cache *cache, size_t cap)
+{
+	size_t slots = 1;
+	while (slots < cap)
+		slots *= 2;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->entries = calloc(slots, sizeof(*cache->entries));
+	if (!cache->entries)
+		return -1;
+	cache->cap = slots;
+	return 0;
+}
+
+/**
+ * @brief Returns the subscribers of a topic, walking the trie only when the
+ *        cached result is missing or stale
+ *
+ * A slot holding another topic is overwritten, so memory stays bounded by the
+ * number of slots no matter how many distinct topics are published.
+ *
+ * @param[in,out] cache Match cache
+ * @param[in] trie Subscription trie
+ * @param[in] topic Interned topic
+ * @return Subscriber set owned by the cache, valid until the next lookup,
+ *         NULL on allocation failure
+ */
+const struct sub_set *match_cache_lookup(struct match_cache *cache,
+					 const struct sub_trie *trie,
+					 const struct topic_entry *topic)
+{
+	struct match_cache_entry *e =
+		&cache->entries[topic->id & (cache->cap - 1)];
+
+	// IDs are recycled after eviction, serials are not
+	if (e->serial == topic->serial) {
+		if (trie_path_valid(&e->path)) {
+			cache->stats.hits++;
+			return &e->subs;
+		}
+		cache->stats.stale++;
+	} else {
+		cache->stats.misses++;
+	}
+
+	if (trie_match(trie, topic->topic, topic->len, &e->subs, &e->path) ==
+	    -1) {
+		e->serial = 0;
+		return NULL;
+	}
+	e->serial = topic->serial;
+	return &e->subs;
+}
+
+void match_cache_destroy(struct match_cache *cache)
+{
+	for (size_t i = 0; i < cache->cap; i++) {
+		trie_path_release(&cache->entries[i].path);
+		sub_set_release(&cache->entries[i].subs);
+	}
+	free(cache->entries);
+	memset(cache, 0, sizeof(*cache));
+}
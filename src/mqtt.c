@@ -1,5 +1,6 @@
 #include "../include/mqtt.h"
 #include "../include/pack.h"
+#include "../include/trace.h"
 #include <stdlib.h>
 
 /**
@@ -170,6 +171,60 @@ unsigned long long mqtt_decode_length(const unsigned char **buf)
 }
 /**@}*/
 
+/** @name MQTT frame inspection functions */
+/**@{*/
+/**
+ * @brief Locates the topic of a PUBLISH frame in place, without allocating
+ *
+ * Unlike mqtt_decode_length, every read is checked against len, since the
+ * frame may still be arriving.
+ *
+ * @param[in] buf Buffer starting at the fixed header
+ * @param[in] len Number of bytes available in buf
+ * @param[out] topic Topic name inside buf
+ * @param[out] topiclen Length of the topic name
+ * @return Length of the whole frame, 0 if buf does not hold the topic yet,
+ *         -1 if the frame is not a well formed PUBLISH
+ */
+long mqtt_peek_publish(const unsigned char *buf, size_t len,
+                       const unsigned char **topic, unsigned short *topiclen)
+{
+    TRACE_BEGIN(start);
+    if (len < 1)
+        return 0;
+    if ((buf[0] & 0xF0) != PUBLISH_BYTE)
+        return -1;
+    size_t pos = 1;
+    unsigned long remaining = 0;
+    unsigned long multiplier = 1;
+    for (;;) {
+        if (pos > (size_t)MAX_LEN_BYTES)
+            return -1;
+        if (pos >= len)
+            return 0;
+        remaining += (buf[pos] & 127) * multiplier;
+        multiplier *= 128;
+        if ((buf[pos++] & 128) == 0)
+            break;
+    }
+    if (remaining < sizeof(uint16_t))
+        return -1;
+    if (len < pos + sizeof(uint16_t))
+        return 0;
+    const uint8_t *ptr = buf + pos;
+    uint16_t tlen = unpack_u16(&ptr);
+    if (tlen > remaining - sizeof(uint16_t))
+        return -1;
+    if (len < pos + sizeof(uint16_t) + tlen)
+        return 0;
+    *topic = ptr;
+    *topiclen = tlen;
+    // Only complete headers are sampled, partial reads are retried later
+    TRACE_END(start, TRACE_DECODE, PUBLISH);
+    return pos + remaining;
+}
+/**@}*/
+
 /** @name MQTT packet unpacking functions */
 /**@{*/
 /**
@@ -0,0 +1,220 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "../include/network.h"
+
+/**
+ * @file network.c
+ * @brief Implementation of the socket utilities shared by the broker
+ */
+
+/** Maximum number of pending connections on a listening socket */
+static const int BACKLOG = 128;
+
+int set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags == -1)
+		return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int set_tcp_nodelay(int fd)
+{
+	int one = 1;
+	return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/**
+ * @brief Resolves host:port and returns the first socket that either binds or
+ *        connects successfully
+ *
+ * @param[in] host Address to resolve
+ * @param[in] port Port to resolve
+ * @param[in] do_bind Non zero to bind the socket, zero to connect it
+ * @return Socket file descriptor, -1 on failure
+ */
+static int resolve_socket(const char *host, const char *port, int do_bind)
+{
+	struct addrinfo hints = { .ai_family = AF_UNSPEC,
+				  .ai_socktype = SOCK_STREAM,
+				  .ai_flags = do_bind ? AI_PASSIVE : 0 };
+	struct addrinfo *result, *rp;
+	int fd = -1;
+
+	if (getaddrinfo(host, port, &hints, &result) != 0)
+		return -1;
+
+	for (rp = result; rp != NULL; rp = rp->ai_next) {
+		fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+		if (fd == -1)
+			continue;
+		if (do_bind) {
+			int one = 1;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one,
+				   sizeof(one));
+			if (bind(fd, rp->ai_addr, rp->ai_addrlen) == 0)
+				break;
+		} else if (connect(fd, rp->ai_addr, rp->ai_addrlen) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(result);
+	return fd;
+}
+
+int make_listen(const char *host, const char *port)
+{
+	int fd = resolve_socket(host, port, 1);
+	if (fd == -1)
+		return -1;
+	if (listen(fd, BACKLOG) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int make_connection(const char *host, const char *port)
+{
+	int fd = resolve_socket(host, port, 0);
+	if (fd != -1)
+		set_tcp_nodelay(fd);
+	return fd;
+}
+
+/**
+ * @brief Fills a Unix domain socket address, failing if path does not fit
+ */
+static int unix_address(struct sockaddr_un *addr, const char *path)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+/**
+ * @brief Removes the socket file at addr if no listener is behind it
+ *
+ * Only a refused connection proves the file is stale. Anything else, a
+ * listener that accepts or a full backlog, leaves it in place for bind to
+ * fail on.
+ */
+static void unlink_stale(const struct sockaddr_un *addr)
+{
+	struct stat st;
+	if (stat(addr->sun_path, &st) == -1 || !S_ISSOCK(st.st_mode))
+		return;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return;
+	if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == -1 &&
+	    errno == ECONNREFUSED)
+		unlink(addr->sun_path);
+	close(fd);
+}
+
+int make_unix_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	if (unix_address(&addr, path) == -1)
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	unlink_stale(&addr);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(fd, BACKLOG) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int make_unix_connection(const char *path)
+{
+	struct sockaddr_un addr;
+	if (unix_address(&addr, path) == -1)
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int set_socket_buffers(int fd, int size)
+{
+	if (size <= 0)
+		return 0;
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == -1)
+		return -1;
+	return setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+int socket_port(int fd)
+{
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	if (getsockname(fd, (struct sockaddr *)&addr, &len) == -1)
+		return -1;
+	if (addr.ss_family == AF_INET)
+		return ntohs(((struct sockaddr_in *)&addr)->sin_port);
+	if (addr.ss_family == AF_INET6)
+		return ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+	return -1;
+}
+
+ssize_t send_bytes(int fd, const unsigned char *buf, size_t len)
+{
+	size_t total = 0;
+	while (total < len) {
+		ssize_t n = send(fd, buf + total, len - total, MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		total += n;
+	}
+	return total;
+}
+
+ssize_t recv_bytes(int fd, unsigned char *buf, size_t len)
+{
+	size_t total = 0;
+	while (total < len) {
+		ssize_t n = recv(fd, buf + total, len - total, 0);
+		if (n == 0)
+			return 0;
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		total += n;
+	}
+	return total;
+}
@@ -47,6 +47,15 @@ uint16_t unpack_string16(uint8_t **buf, uint8_t **dest)
 	return len;
 }
 
+// Point at a string prefixed by its length as a uint16 value, without copying
+uint16_t unpack_string16_view(const uint8_t **buf, const uint8_t **dest)
+{
+	uint16_t len = unpack_u16(buf);
+	*dest = *buf;
+	(*buf) += len;
+	return len;
+}
+
 // append a uint8_t -> bytes into the bytestring
 void pack_u8(uint8_t **buf, uint8_t val)
 {
@@ -77,3 +86,17 @@ void pack_bytes(uint8_t **buf, uint8_t *str)
 	memcpy(*buf, str, len);
 	(*buf) += len;
 }
+
+// append exactly len bytes into the bytestring, binary safe
+void pack_nbytes(uint8_t **buf, const uint8_t *bytes, size_t len)
+{
+	memcpy(*buf, bytes, len);
+	(*buf) += len;
+}
+
+// append a string prefixed by its length as a uint16 value
+void pack_string16(uint8_t **buf, const uint8_t *str, uint16_t len)
+{
+	pack_u16(buf, len);
+	pack_nbytes(buf, str, len);
+}
@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/pktid.h"
+
+/**
+ * @file pktid.c
+ * @brief Implementation of the adaptive packet ID set
+ */
+
+#define WORD(id) ((id) >> 6)
+#define BIT(id) (UINT64_C(1) << ((id) & 63))
+
+/** Slots of the sorted array when it is first allocated */
+#define SORTED_MIN_CAP 8
+
+void pktid_set_init(struct pktid_set *set)
+{
+	memset(set, 0, sizeof(*set));
+}
+
+/**
+ * @brief Returns the inline slot holding an ID, -1 if absent
+ */
+static int inline_find(const struct pktid_set *set, uint16_t id)
+{
+	for (uint32_t i = 0; i < set->count; i++)
+		if (set->ids[i] == id)
+			return i;
+	return -1;
+}
+
+/**
+ * @brief Returns the slot of the sorted array an ID is at or belongs at
+ */
+static uint32_t sorted_find(const struct pktid_set *set, uint16_t id)
+{
+	uint32_t lo = 0, hi = set->count;
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (set->sorted[mid] < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int sorted_contains(const struct pktid_set *set, uint16_t id)
+{
+	uint32_t i = sorted_find(set, id);
+	return i < set->count && set->sorted[i] == id;
+}
+
+/**
+ * @brief Moves the inline IDs into a freshly allocated sorted array
+ */
+static int to_sorted(struct pktid_set *set)
+{
+	uint16_t *sorted = malloc(SORTED_MIN_CAP * sizeof(*sorted));
+	if (!sorted)
+		return -1;
+	// Insertion sort of at most PKTID_INLINE IDs
+	for (uint32_t i = 0; i < set->count; i++) {
+		uint32_t j = i;
+		for (; j > 0 && sorted[j - 1] > set->ids[i]; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = set->ids[i];
+	}
+	set->sorted = sorted;
+	set->cap = SORTED_MIN_CAP;
+	set->mode = PKTID_MODE_SORTED;
+	return 0;
+}
+
+/**
+ * @brief Moves the sorted IDs into a freshly allocated bitmap
+ */
+static int to_bitmap(struct pktid_set *set)
+{
+	uint64_t *bitmap = calloc(PKTID_BITMAP_WORDS, sizeof(*bitmap));
+	if (!bitmap)
+		return -1;
+	for (uint32_t i = 0; i < set->count; i++)
+		bitmap[WORD(set->sorted[i])] |= BIT(set->sorted[i]);
+	free(set->sorted);
+	set->bitmap = bitmap;
+	set->cap = 0;
+	set->mode = PKTID_MODE_BITMAP;
+	return 0;
+}
+
+/**
+ * @brief Moves the sorted IDs back inline and frees the array
+ *
+ * Called once count is PKTID_SHRINK_INLINE or less.
+ */
+static void to_inline(struct pktid_set *set)
+{
+	uint16_t ids[PKTID_SHRINK_INLINE];
+
+	memcpy(ids, set->sorted, set->count * sizeof(*ids));
+	free(set->sorted);
+	memcpy(set->ids, ids, set->count * sizeof(*ids));
+	set->cap = 0;
+	set->mode = PKTID_MODE_INLINE;
+}
+
+/**
+ * @brief Moves the bitmap IDs back into a sorted array and frees the bitmap
+ *
+ * Called once count is PKTID_SHRINK_SORTED or less. The array gets room up
+ * to PKTID_SORTED_MAX, and if it cannot be allocated the set simply stays a
+ * bitmap.
+ */
+static void bitmap_to_sorted(struct pktid_set *set)
+{
+	uint16_t *sorted = malloc(PKTID_SORTED_MAX * sizeof(*sorted));
+	if (!sorted)
+		return;
+	uint32_t n = 0;
+	for (uint32_t id = 0; n < set->count; id++)
+		if (set->bitmap[WORD(id)] & BIT(id))
+			sorted[n++] = id;
+	free(set->bitmap);
+	set->sorted = sorted;
+	set->cap = PKTID_SORTED_MAX;
+	set->mode = PKTID_MODE_SORTED;
+}
+
+static int sorted_add(struct pktid_set *set, uint16_t id)
+{
+	uint32_t i = sorted_find(set, id);
+	if (i < set->count && set->sorted[i] == id)
+		return 0;
+	if (set->count == set->cap) {
+		uint16_t cap = set->cap * 2;
+		uint16_t *sorted = realloc(set->sorted, cap * sizeof(*sorted));
+		if (!sorted)
+			return -1;
+		set->sorted = sorted;
+		set->cap = cap;
+	}
+	memmove(set->sorted + i + 1, set->sorted + i,
+		(set->count - i) * sizeof(*set->sorted));
+	set->sorted[i] = id;
+	set->count++;
+	return 1;
+}
+
+int pktid_set_add(struct pktid_set *set, uint16_t id)
+{
+	switch (set->mode) {
+	case PKTID_MODE_INLINE:
+		if (inline_find(set, id) != -1)
+			return 0;
+		if (set->count < PKTID_INLINE) {
+			set->ids[set->count++] = id;
+			return 1;
+		}
+		if (to_sorted(set) == -1)
+			return -1;
+		return sorted_add(set, id);
+	case PKTID_MODE_SORTED:
+		if (set->count < PKTID_SORTED_MAX)
+			return sorted_add(set, id);
+		if (sorted_contains(set, id))
+			return 0;
+		if (to_bitmap(set) == -1)
+			return -1;
+		break;
+	}
+
+	if (set->bitmap[WORD(id)] & BIT(id))
+		return 0;
+	set->bitmap[WORD(id)] |= BIT(id);
+	set->count++;
+	return 1;
+}
+
+int pktid_set_contains(const struct pktid_set *set, uint16_t id)
+{
+	switch (set->mode) {
+	case PKTID_MODE_INLINE:
+		return inline_find(set, id) != -1;
+	case PKTID_MODE_SORTED:
+		return sorted_contains(set, id);
+	}
+	return (set->bitmap[WORD(id)] & BIT(id)) != 0;
+}
+
+int pktid_set_remove(struct pktid_set *set, uint16_t id)
+{
+	uint32_t i;
+
+	switch (set->mode) {
+	case PKTID_MODE_INLINE: {
+		int slot = inline_find(set, id);
+		if (slot == -1)
+			return 0;
+		set->ids[slot] = set->ids[--set->count];
+		return 1;
+	}
+	case PKTID_MODE_SORTED:
+		i = sorted_find(set, id);
+		if (i == set->count || set->sorted[i] != id)
+			return 0;
+		memmove(set->sorted + i, set->sorted + i + 1,
+			(set->count - i - 1) * sizeof(*set->sorted));
+		set->count--;
+		break;
+	default:
+		if (!(set->bitmap[WORD(id)] & BIT(id)))
+			return 0;
+		set->bitmap[WORD(id)] &= ~BIT(id);
+		set->count--;
+		break;
+	}
+
+	// Well below the size it grew at, give the memory back
+	if (set->mode == PKTID_MODE_SORTED && set->count <= PKTID_SHRINK_INLINE)
+		to_inline(set);
+	else if (set->mode == PKTID_MODE_BITMAP &&
+		 set->count <= PKTID_SHRINK_SORTED)
+		bitmap_to_sorted(set);
+	return 1;
+}
+
+void pktid_set_release(struct pktid_set *set)
+{
+	if (set->mode == PKTID_MODE_SORTED)
+		free(set->sorted);
+	else if (set->mode == PKTID_MODE_BITMAP)
+		free(set->bitmap);
+	pktid_set_init(set);
+}
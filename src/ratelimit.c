@@ -0,0 +1,342 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/ratelimit.h"
+#include "../include/util.h"
+
+/**
+ * @file ratelimit.c
+ * @brief Implementation of the ingress token-bucket limits
+ *
+ * Every bucket is charged with the GCRA form of a token bucket: the
+ * theoretical arrival time advances by cost / rate per PUBLISH, and the
+ * publisher is over its limit once it runs more than burst / rate ahead of
+ * the clock. The PUBLISH is charged either way, so the returned delay is
+ * exactly the time until the bucket is back within its burst.
+ *
+ * Rules are allocated one by one and never move, and they are fixed once
+ * the first connection is attached, so the publish path reads them without
+ * a lock and only the shared buckets themselves are written concurrently.
+ */
+
+/** Number of chains of the username table */
+#define USER_BUCKETS 1024
+
+/** Number of chains of the rule table */
+#define RULE_BUCKETS 256
+
+#define NS_PER_SEC 1000000000ULL
+
+/**
+ * @brief Charges cost units to one bucket, returns the resulting delay
+ */
+static uint64_t charge(_Atomic uint64_t *tat, uint64_t now, uint64_t cost,
+		       uint32_t rate, uint32_t burst)
+{
+	if (rate == 0)
+		return 0;
+	uint64_t tolerance = (uint64_t)burst * NS_PER_SEC / rate;
+	uint64_t inc = cost * NS_PER_SEC / rate;
+	uint64_t old = atomic_load_explicit(tat, memory_order_relaxed), next;
+	do {
+		next = (old < now ? now : old) + inc;
+	} while (!atomic_compare_exchange_weak_explicit(tat, &old, next,
+							memory_order_relaxed,
+							memory_order_relaxed));
+	return next > now + tolerance ? next - now - tolerance : 0;
+}
+
+static uint64_t charge_bucket(struct rate_bucket *bucket,
+			      const struct rate_limit *limit, size_t bytes,
+			      uint64_t now)
+{
+	uint64_t msgs = charge(&bucket->msgs_tat, now, 1, limit->msgs_per_sec,
+			       limit->msg_burst);
+	uint64_t data = charge(&bucket->bytes_tat, now, bytes,
+			       limit->bytes_per_sec, limit->byte_burst);
+	return msgs > data ? msgs : data;
+}
+
+int ratelimit_init(struct ratelimit *rl)
+{
+	memset(rl, 0, sizeof(*rl));
+	rl->users = calloc(USER_BUCKETS, sizeof(*rl->users));
+	rl->rules = calloc(RULE_BUCKETS, sizeof(*rl->rules));
+	if (!rl->users || !rl->rules) {
+		free(rl->users);
+		free(rl->rules);
+		return -1;
+	}
+	rl->nbuckets = USER_BUCKETS;
+	atomic_init(&rl->sealed, false);
+	pthread_mutex_init(&rl->lock, NULL);
+	return 0;
+}
+
+static size_t rule_slot(enum ratelimit_scope scope, uint32_t hash)
+{
+	return (hash ^ scope) & (RULE_BUCKETS - 1);
+}
+
+/**
+ * @brief Returns the rule of an exact key whose hash is already known
+ */
+static struct ratelimit_rule *lookup(struct ratelimit *rl,
+				     enum ratelimit_scope scope,
+				     const unsigned char *key, size_t len,
+				     uint32_t hash)
+{
+	struct ratelimit_rule *rule = rl->rules[rule_slot(scope, hash)];
+	for (; rule; rule = rule->next)
+		if (rule->scope == scope && rule->keylen == len &&
+		    memcmp(rule->key, key, len) == 0)
+			return rule;
+	return NULL;
+}
+
+/**
+ * @brief Returns the rule of an exact key, or the scope default if key is
+ *        NULL, NULL if there is none
+ */
+static struct ratelimit_rule *find_rule(struct ratelimit *rl,
+					enum ratelimit_scope scope,
+					const unsigned char *key, size_t len)
+{
+	if (!key)
+		return rl->defaults[scope];
+	if (len > UINT16_MAX)
+		return NULL;
+	return lookup(rl, scope, key, len, fnv1a(key, len));
+}
+
+/**
+ * @brief Records the length of a new topic prefix, keeping them sorted
+ */
+static int add_prefix_len(struct ratelimit *rl, uint16_t len)
+{
+	size_t i = 0;
+	while (i < rl->nprefix_lens && rl->prefix_lens[i] < len)
+		i++;
+	if (i < rl->nprefix_lens && rl->prefix_lens[i] == len)
+		return 0;
+
+	uint16_t *lens = realloc(rl->prefix_lens,
+				 (rl->nprefix_lens + 1) * sizeof(*lens));
+	if (!lens)
+		return -1;
+	memmove(&lens[i + 1], &lens[i], (rl->nprefix_lens - i) * sizeof(*lens));
+	lens[i] = len;
+	rl->prefix_lens = lens;
+	rl->nprefix_lens++;
+	return 0;
+}
+
+int ratelimit_add(struct ratelimit *rl, enum ratelimit_scope scope,
+		  const unsigned char *key, uint16_t keylen,
+		  struct rate_limit limit)
+{
+	if (scope == RATELIMIT_TOPIC && !key)
+		return -1;
+	if (atomic_load(&rl->sealed)) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	struct ratelimit_rule *rule = find_rule(rl, scope, key, keylen);
+	if (rule) {
+		rule->limit = limit;
+		return 0;
+	}
+
+	rule = calloc(1, sizeof(*rule));
+	if (!rule)
+		return -1;
+	rule->scope = scope;
+	rule->keylen = keylen;
+	rule->limit = limit;
+	if (!key) {
+		rl->defaults[scope] = rule;
+		return 0;
+	}
+
+	rule->key = malloc(keylen ? keylen : 1);
+	if (!rule->key ||
+	    (scope == RATELIMIT_TOPIC && add_prefix_len(rl, keylen) == -1)) {
+		free(rule->key);
+		free(rule);
+		return -1;
+	}
+	memcpy(rule->key, key, keylen);
+	size_t slot = rule_slot(scope, fnv1a(key, keylen));
+	rule->next = rl->rules[slot];
+	rl->rules[slot] = rule;
+	return 0;
+}
+
+/**
+ * @brief Returns the exact rule of a key, falling back to the scope default
+ */
+static const struct rate_limit *resolve(struct ratelimit *rl,
+					enum ratelimit_scope scope,
+					const unsigned char *key, size_t len)
+{
+	struct ratelimit_rule *rule = find_rule(rl, scope, key, len);
+	if (!rule)
+		rule = find_rule(rl, scope, NULL, 0);
+	return rule ? &rule->limit : NULL;
+}
+
+/**
+ * @brief Takes a reference on the shared bucket of a username, called with
+ *        the lock held
+ */
+static struct ratelimit_user *user_get(struct ratelimit *rl,
+				       const unsigned char *username,
+				       size_t len,
+				       const struct rate_limit *limit)
+{
+	size_t slot = fnv1a(username, len) & (rl->nbuckets - 1);
+	struct ratelimit_user *user;
+
+	for (user = rl->users[slot]; user; user = user->next) {
+		if (user->len == len && memcmp(user->username, username, len) == 0) {
+			user->refcount++;
+			return user;
+		}
+	}
+
+	user = calloc(1, sizeof(*user));
+	if (!user)
+		return NULL;
+	user->username = malloc(len ? len : 1);
+	if (!user->username) {
+		free(user);
+		return NULL;
+	}
+	memcpy(user->username, username, len);
+	user->len = len;
+	user->refcount = 1;
+	user->limit = limit;
+	user->next = rl->users[slot];
+	rl->users[slot] = user;
+	return user;
+}
+
+int ratelimit_attach(struct ratelimit *rl, struct ratelimit_client *client,
+		     const unsigned char *client_id, size_t cid_len,
+		     const unsigned char *username, size_t ulen)
+{
+	memset(client, 0, sizeof(*client));
+	atomic_store(&rl->sealed, true);
+	client->limit = resolve(rl, RATELIMIT_CLIENT, client_id, cid_len);
+	if (!username || ulen > UINT16_MAX)
+		return 0;
+
+	const struct rate_limit *limit =
+		resolve(rl, RATELIMIT_USERNAME, username, ulen);
+	if (!limit)
+		return 0;
+	pthread_mutex_lock(&rl->lock);
+	client->user = user_get(rl, username, ulen, limit);
+	pthread_mutex_unlock(&rl->lock);
+	return client->user ? 0 : -1;
+}
+
+void ratelimit_detach(struct ratelimit *rl, struct ratelimit_client *client)
+{
+	struct ratelimit_user *user = client->user;
+	client->user = NULL;
+	if (!user)
+		return;
+
+	pthread_mutex_lock(&rl->lock);
+	if (--user->refcount == 0) {
+		size_t slot = fnv1a(user->username, user->len) &
+			      (rl->nbuckets - 1);
+		struct ratelimit_user **link = &rl->users[slot];
+		while (*link != user)
+			link = &(*link)->next;
+		*link = user->next;
+		free(user->username);
+		free(user);
+	}
+	pthread_mutex_unlock(&rl->lock);
+}
+
+/**
+ * @brief Returns the topic rule with the longest prefix of topic
+ *
+ * The topic is hashed once, up to the longest configured prefix, and the
+ * table is probed at each distinct prefix length on the way.
+ */
+static struct ratelimit_rule *match_topic(struct ratelimit *rl,
+					  const unsigned char *topic,
+					  size_t len)
+{
+	struct ratelimit_rule *best = NULL, *rule;
+	uint32_t hash = FNV1A_INIT;
+	size_t hashed = 0;
+
+	for (size_t i = 0; i < rl->nprefix_lens; i++) {
+		size_t plen = rl->prefix_lens[i];
+		if (plen > len)
+			break;
+		hash = fnv1a_update(hash, topic + hashed, plen - hashed);
+		hashed = plen;
+		rule = lookup(rl, RATELIMIT_TOPIC, topic, plen, hash);
+		if (rule)
+			best = rule;
+	}
+	return best;
+}
+
+uint64_t ratelimit_publish(struct ratelimit *rl,
+			   struct ratelimit_client *client,
+			   const unsigned char *topic, size_t topiclen,
+			   size_t bytes, uint64_t now)
+{
+	uint64_t delay = 0, d;
+
+	if (client->limit)
+		delay = charge_bucket(&client->bucket, client->limit, bytes, now);
+
+	struct ratelimit_rule *rule = match_topic(rl, topic, topiclen);
+	if (client->user) {
+		d = charge_bucket(&client->user->bucket, client->user->limit,
+				  bytes, now);
+		if (d > delay)
+			delay = d;
+	}
+	if (rule) {
+		d = charge_bucket(&rule->bucket, &rule->limit, bytes, now);
+		if (d > delay)
+			delay = d;
+	}
+	return delay;
+}
+
+void ratelimit_destroy(struct ratelimit *rl)
+{
+	for (size_t i = 0; i < rl->nbuckets; i++) {
+		while (rl->users[i]) {
+			struct ratelimit_user *user = rl->users[i];
+			rl->users[i] = user->next;
+			free(user->username);
+			free(user);
+		}
+	}
+	for (size_t i = 0; i < RULE_BUCKETS; i++) {
+		while (rl->rules[i]) {
+			struct ratelimit_rule *rule = rl->rules[i];
+			rl->rules[i] = rule->next;
+			free(rule->key);
+			free(rule);
+		}
+	}
+	for (size_t i = 0; i < RATELIMIT_TOPIC; i++)
+		free(rl->defaults[i]);
+	free(rl->rules);
+	free(rl->prefix_lens);
+	free(rl->users);
+	pthread_mutex_destroy(&rl->lock);
+}
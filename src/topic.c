@@ -0,0 +1,119 @@
+#include <string.h>
+#include "../include/topic.h"
+
+/**
+ * @file topic.c
+ * @brief Implementation of MQTT topic name and topic filter matching
+ *
+ * Topic names and filters are split into levels on '/'. Levels are walked
+ * in place, without copying, so both functions can be used directly on
+ * length prefixed strings inside a packet buffer.
+ */
+
+/**
+ * @brief Returns the position of the separator that ends the level at pos
+ *
+ * @param[in] s Topic name or filter
+ * @param[in] len Length of s
+ * @param[in] pos Start position of the level
+ * @return Position of the next '/' or len if pos is in the last level
+ */
+static size_t level_end(const unsigned char *s, size_t len, size_t pos)
+{
+	while (pos < len && s[pos] != TOPIC_SEPARATOR)
+		pos++;
+	return pos;
+}
+
+/**
+ * @brief Checks whether the level [start, end) is a single wildcard character
+ */
+static int is_wildcard(const unsigned char *s, size_t start, size_t end,
+		       unsigned char wildcard)
+{
+	return end - start == 1 && s[start] == wildcard;
+}
+
+/**
+ * @brief Checks whether a topic name matches a topic filter
+ *
+ * Follows the MQTT v3.1.1 matching rules: '+' matches exactly one level,
+ * '#' matches the parent level and any number of child levels, and topics
+ * starting with '$' are never matched by a leading wildcard.
+ *
+ * @param[in] filter Topic filter, may contain '+' and '#' wildcards
+ * @param[in] filterlen Length of the topic filter
+ * @param[in] topic Topic name
+ * @param[in] topiclen Length of the topic name
+ * @return 1 if the topic matches the filter, 0 otherwise
+ */
+int topic_match(const unsigned char *filter, size_t filterlen,
+		const unsigned char *topic, size_t topiclen)
+{
+	size_t fi = 0, ti = 0;
+
+	if (topiclen > 0 && topic[0] == '$' && filterlen > 0 &&
+	    (filter[0] == TOPIC_WILDCARD_ONE || filter[0] == TOPIC_WILDCARD_ALL))
+		return 0;
+
+	for (;;) {
+		size_t fe = level_end(filter, filterlen, fi);
+		if (is_wildcard(filter, fi, fe, TOPIC_WILDCARD_ALL))
+			return 1;
+		if (ti > topiclen)
+			return 0;
+		size_t te = level_end(topic, topiclen, ti);
+		if (!is_wildcard(filter, fi, fe, TOPIC_WILDCARD_ONE) &&
+		    (fe - fi != te - ti ||
+		     memcmp(filter + fi, topic + ti, fe - fi) != 0))
+			return 0;
+		fi = fe + 1;
+		ti = te + 1;
+		if (fi > filterlen)
+			return ti > topiclen;
+	}
+}
+
+/**
+ * @brief Checks whether a topic filter covers another topic filter
+ *
+ * A '#' level in a covers everything that follows in b, a '+' level in a
+ * covers any single level of b except '#', and literal levels must be equal.
+ *
+ * @param[in] a Covering topic filter
+ * @param[in] alen Length of the covering topic filter
+ * @param[in] b Covered topic filter
+ * @param[in] blen Length of the covered topic filter
+ * @return 1 if a covers b, 0 otherwise
+ */
+int topic_filter_covers(const unsigned char *a, size_t alen,
+			const unsigned char *b, size_t blen)
+{
+	size_t ai = 0, bi = 0;
+
+	if (blen > 0 && b[0] == '$' && alen > 0 &&
+	    (a[0] == TOPIC_WILDCARD_ONE || a[0] == TOPIC_WILDCARD_ALL))
+		return 0;
+
+	for (;;) {
+		size_t ae = level_end(a, alen, ai);
+		if (is_wildcard(a, ai, ae, TOPIC_WILDCARD_ALL))
+			return 1;
+		if (bi > blen)
+			return 0;
+		size_t be = level_end(b, blen, bi);
+		if (is_wildcard(b, bi, be, TOPIC_WILDCARD_ALL))
+			return 0;
+		if (!is_wildcard(a, ai, ae, TOPIC_WILDCARD_ONE)) {
+			if (is_wildcard(b, bi, be, TOPIC_WILDCARD_ONE))
+				return 0;
+			if (ae - ai != be - bi ||
+			    memcmp(a + ai, b + bi, ae - ai) != 0)
+				return 0;
+		}
+		ai = ae + 1;
+		bi = be + 1;
+		if (ai > alen)
+			return bi > blen;
+	}
+}
@@ -0,0 +1,165 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/trace.h"
+#include "../include/util.h"
+
+/**
+ * @file trace.c
+ * @brief Implementation of the per-thread latency histograms
+ *
+ * Each thread lazily allocates its own table of histograms on its first
+ * sample and links it into a global list, which is only walked by
+ * trace_snapshot. Threads never write to each other's tables, so recording a
+ * sample needs no lock and no atomic read-modify-write: the owner does a
+ * relaxed load and store per counter, which only guarantees that a
+ * concurrent trace_snapshot reads whole values instead of torn ones. Tables
+ * are kept for the lifetime of the process so samples of exited threads are
+ * still reported.
+ */
+
+/**
+ * @brief Counters of one histogram, written by the owning thread only
+ */
+struct trace_counters {
+	_Atomic uint64_t count;
+	_Atomic uint64_t total_ns;
+	_Atomic uint64_t max_ns;
+	_Atomic uint64_t buckets[TRACE_BUCKETS];
+};
+
+/**
+ * @brief Histograms of one thread
+ */
+struct trace_table {
+	struct trace_counters hist[TRACE_STAGES][TRACE_TYPES];
+	struct trace_table *next;
+};
+
+static _Thread_local struct trace_table *local;
+static struct trace_table *tables;
+static pthread_mutex_t tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *const stage_names[TRACE_STAGES] = {
+	"read", "decode", "route", "encode", "write"
+};
+
+uint64_t trace_now(void)
+{
+	return monotonic_ns();
+}
+
+static struct trace_table *local_table(void)
+{
+	if (local)
+		return local;
+	local = calloc(1, sizeof(*local));
+	if (!local)
+		return NULL;
+	pthread_mutex_lock(&tables_lock);
+	local->next = tables;
+	tables = local;
+	pthread_mutex_unlock(&tables_lock);
+	return local;
+}
+
+/**
+ * @brief Returns the log2 bucket of a duration
+ */
+static unsigned bucket_of(uint64_t ns)
+{
+	unsigned b = 0;
+	while (ns > 0 && b < TRACE_BUCKETS - 1) {
+		ns >>= 1;
+		b++;
+	}
+	return b;
+}
+
+static uint64_t load(_Atomic uint64_t *counter)
+{
+	return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static void store(_Atomic uint64_t *counter, uint64_t value)
+{
+	atomic_store_explicit(counter, value, memory_order_relaxed);
+}
+
+void trace_record(enum trace_stage stage, unsigned type, uint64_t ns)
+{
+	struct trace_table *t = local_table();
+	if (!t || stage >= TRACE_STAGES || type >= TRACE_TYPES)
+		return;
+	struct trace_counters *h = &t->hist[stage][type];
+	store(&h->count, load(&h->count) + 1);
+	store(&h->total_ns, load(&h->total_ns) + ns);
+	if (ns > load(&h->max_ns))
+		store(&h->max_ns, ns);
+	unsigned b = bucket_of(ns);
+	store(&h->buckets[b], load(&h->buckets[b]) + 1);
+}
+
+void trace_snapshot(struct trace_histogram *out, enum trace_stage stage,
+		    unsigned type)
+{
+	memset(out, 0, sizeof(*out));
+	if (stage >= TRACE_STAGES || type >= TRACE_TYPES)
+		return;
+
+	pthread_mutex_lock(&tables_lock);
+	for (struct trace_table *t = tables; t; t = t->next) {
+		struct trace_counters *h = &t->hist[stage][type];
+		out->count += load(&h->count);
+		out->total_ns += load(&h->total_ns);
+		uint64_t max_ns = load(&h->max_ns);
+		if (max_ns > out->max_ns)
+			out->max_ns = max_ns;
+		for (int b = 0; b < TRACE_BUCKETS; b++)
+			out->buckets[b] += load(&h->buckets[b]);
+	}
+	pthread_mutex_unlock(&tables_lock);
+}
+
+uint64_t trace_percentile(const struct trace_histogram *hist, double p)
+{
+	if (hist->count == 0)
+		return 0;
+	uint64_t rank = (uint64_t)(hist->count * p / 100.0);
+	if (rank >= hist->count)
+		rank = hist->count - 1;
+
+	uint64_t seen = 0;
+	for (int b = 0; b < TRACE_BUCKETS; b++) {
+		seen += hist->buckets[b];
+		if (seen > rank) {
+			// The top bucket's bound can be far above any sample
+			uint64_t bound = b == 0 ? 0 : UINT64_C(1) << b;
+			return bound < hist->max_ns ? bound : hist->max_ns;
+		}
+	}
+	return hist->max_ns;
+}
+
+void trace_dump(FILE *fp)
+{
+	fprintf(fp, "%-8s %4s %10s %10s %10s %10s %10s\n", "stage", "type",
+		"count", "mean_ns", "p50_ns", "p99_ns", "max_ns");
+	for (int s = 0; s < TRACE_STAGES; s++) {
+		for (unsigned type = 0; type < TRACE_TYPES; type++) {
+			struct trace_histogram h;
+			trace_snapshot(&h, s, type);
+			if (h.count == 0)
+				continue;
+			fprintf(fp, "%-8s %4u %10llu %10llu %10llu %10llu %10llu\n",
+				stage_names[s], type,
+				(unsigned long long)h.count,
+				(unsigned long long)(h.total_ns / h.count),
+				(unsigned long long)trace_percentile(&h, 50),
+				(unsigned long long)trace_percentile(&h, 99),
+				(unsigned long long)h.max_ns);
+		}
+	}
+}
@@ -0,0 +1,434 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/trie.h"
+#include "../include/topic.h"
+#include "../include/trace.h"
+#include "../include/mqtt.h"
+#include "../include/util.h"
+
+/**
+ * @file trie.c
+ * @brief Implementation of the subscription trie
+ */
+
+/**
+ * @brief Returns the position of the separator that ends the level at pos
+ */
+static size_t level_end(const unsigned char *s, size_t len, size_t pos)
+{
+	while (pos < len && s[pos] != TOPIC_SEPARATOR)
+		pos++;
+	return pos;
+}
+
+void trie_init(struct sub_trie *trie)
+{
+	memset(trie, 0, sizeof(*trie));
+}
+
+/** @name Node handling */
+/**@{*/
+static struct trie_node *node_new(const unsigned char *level,
+				  unsigned short len)
+{
+	struct trie_node *node = calloc(1, sizeof(*node));
+	if (!node)
+		return NULL;
+	node->level = malloc(len + 1);
+	if (!node->level) {
+		free(node);
+		return NULL;
+	}
+	memcpy(node->level, level, len);
+	node->level[len] = '\0';
+	node->len = len;
+	return node;
+}
+
+/**
+ * @brief Returns the generation covering the literal children of a level
+ */
+static uint64_t *child_gen(struct trie_node *node, const unsigned char *level,
+			   size_t len)
+{
+	return &node->child_gens[fnv1a(level, len) & (TRIE_CHILD_GENS - 1)];
+}
+
+/**
+ * @brief Binary searches the literal children of a node
+ *
+ * @return Index of the child if found is set, otherwise where it belongs
+ */
+static size_t child_search(const struct trie_node *node,
+			   const unsigned char *level, size_t len, int *found)
+{
+	size_t lo = 0, hi = node->nchildren;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct trie_node *child = node->children[mid];
+		int cmp = child->len != len ? (child->len < len ? -1 : 1)
+					    : memcmp(child->level, level, len);
+		if (cmp == 0) {
+			*found = 1;
+			return mid;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*found = 0;
+	return lo;
+}
+
+/**
+ * @brief Returns the child slot for a level, NULL if the level is literal
+ *        and not present
+ */
+static struct trie_node **child_slot(struct trie_node *node,
+				     const unsigned char *level, size_t len)
+{
+	if (len == 1 && level[0] == TOPIC_WILDCARD_ONE)
+		return &node->one;
+	if (len == 1 && level[0] == TOPIC_WILDCARD_ALL)
+		return &node->all;
+	int found;
+	size_t i = child_search(node, level, len, &found);
+	return found ? &node->children[i] : NULL;
+}
+
+/**
+ * @brief Finds or creates the child of a node for a filter level
+ *
+ * Creating a child changes what a match walk through the parent finds, so
+ * the parent's generation is bumped, or for a literal child only the
+ * generation of its level hash.
+ */
+static struct trie_node *child_get_or_create(struct sub_trie *trie,
+					     struct trie_node *node,
+					     const unsigned char *level,
+					     size_t len)
+{
+	struct trie_node **slot = child_slot(node, level, len);
+	if (slot && *slot)
+		return *slot;
+
+	struct trie_node *child = node_new(level, len);
+	if (!child)
+		return NULL;
+	if (slot) {
+		*slot = child;
+		node->generation = ++trie->clock;
+		trie->nodes++;
+		return child;
+	}
+
+	if (node->nchildren == node->cap) {
+		size_t cap = node->cap ? node->cap * 2 : 4;
+		void *children = realloc(node->children,
+					 cap * sizeof(*node->children));
+		if (!children) {
+			free(child->level);
+			free(child);
+			return NULL;
+		}
+		node->children = children;
+		node->cap = cap;
+	}
+	int found;
+	size_t i = child_search(node, level, len, &found);
+	memmove(&node->children[i + 1], &node->children[i],
+		(node->nchildren - i) * sizeof(*node->children));
+	node->children[i] = child;
+	node->nchildren++;
+	*child_gen(node, level, len) = ++trie->clock;
+	trie->nodes++;
+	return child;
+}
+
+static int node_empty(const struct trie_node *node)
+{
+	return node->subs.len == 0 && node->nchildren == 0 && !node->one &&
+	       !node->all;
+}
+
+static void node_free(struct trie_node *node)
+{
+	for (size_t i = 0; i < node->nchildren; i++)
+		node_free(node->children[i]);
+	if (node->one)
+		node_free(node->one);
+	if (node->all)
+		node_free(node->all);
+	free(node->children);
+	free(node->level);
+	sub_set_release(&node->subs);
+	free(node);
+}
+/**@}*/
+
+/** @name Set and path handling */
+/**@{*/
+static int sub_set_push(struct sub_set *set, struct subscription sub)
+{
+	if (set->len == set->cap) {
+		size_t cap = set->cap ? set->cap * 2 : 8;
+		void *subs = realloc(set->subs, cap * sizeof(*set->subs));
+		if (!subs)
+			return -1;
+		set->subs = subs;
+		set->cap = cap;
+	}
+	set->subs[set->len++] = sub;
+	return 0;
+}
+
+static int sub_set_append(struct sub_set *set, const struct sub_set *from)
+{
+	for (size_t i = 0; i < from->len; i++)
+		if (sub_set_push(set, from->subs[i]) == -1)
+			return -1;
+	return 0;
+}
+
+static int cmp_client(const void *a, const void *b)
+{
+	unsigned x = ((const struct subscription *)a)->client;
+	unsigned y = ((const struct subscription *)b)->client;
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief Sorts a set by client and merges duplicates, keeping the highest QoS
+ */
+static void sub_set_dedup(struct sub_set *set)
+{
+	if (set->len < 2)
+		return;
+	qsort(set->subs, set->len, sizeof(*set->subs), cmp_client);
+	size_t out = 0;
+	for (size_t i = 1; i < set->len; i++) {
+		if (set->subs[i].client == set->subs[out].client) {
+			if (set->subs[i].qos > set->subs[out].qos)
+				set->subs[out].qos = set->subs[i].qos;
+			continue;
+		}
+		set->subs[++out] = set->subs[i];
+	}
+	set->len = out + 1;
+}
+
+void sub_set_release(struct sub_set *set)
+{
+	free(set->subs);
+	set->subs = NULL;
+	set->len = set->cap = 0;
+}
+
+static int path_push(struct trie_path *path, const uint64_t *generation)
+{
+	if (!path)
+		return 0;
+	if (path->len == path->cap) {
+		size_t cap = path->cap ? path->cap * 2 : 16;
+		void *visits = realloc(path->visits, cap * sizeof(*path->visits));
+		if (!visits)
+			return -1;
+		path->visits = visits;
+		path->cap = cap;
+	}
+	path->visits[path->len].generation = generation;
+	path->visits[path->len].seen = *generation;
+	path->len++;
+	return 0;
+}
+
+/**
+ * @brief Checks whether a recorded walk would still give the same result
+ *
+ * Generations are compared in walk order and the check stops at the first
+ * change: a pruned node's parent comes first and has changed, so the freed
+ * node itself is never read.
+ *
+ * @param[in] path Generations recorded by trie_match
+ * @return 1 if no recorded generation changed since the walk, 0 otherwise
+ */
+int trie_path_valid(const struct trie_path *path)
+{
+	for (size_t i = 0; i < path->len; i++)
+		if (*path->visits[i].generation != path->visits[i].seen)
+			return 0;
+	return 1;
+}
+
+void trie_path_release(struct trie_path *path)
+{
+	free(path->visits);
+	path->visits = NULL;
+	path->len = path->cap = 0;
+}
+/**@}*/
+
+int trie_subscribe(struct sub_trie *trie, const unsigned char *filter,
+		   size_t len, struct subscription sub)
+{
+	struct trie_node *node = &trie->root;
+	size_t pos = 0;
+
+	for (;;) {
+		size_t end = level_end(filter, len, pos);
+		node = child_get_or_create(trie, node, filter + pos, end - pos);
+		if (!node)
+			return -1;
+		if (end >= len)
+			break;
+		pos = end + 1;
+	}
+
+	for (size_t i = 0; i < node->subs.len; i++) {
+		if (node->subs.subs[i].client == sub.client) {
+			node->subs.subs[i].qos = sub.qos;
+			node->generation = ++trie->clock;
+			return 0;
+		}
+	}
+	if (sub_set_push(&node->subs, sub) == -1)
+		return -1;
+	node->generation = ++trie->clock;
+	return 0;
+}
+
+/**
+ * @brief Removes a subscription below node, pruning the nodes it empties
+ *
+ * @param[in,out] trie Subscription trie
+ * @param[in,out] node Node whose child holds the level at pos
+ * @param[in] filter Topic filter
+ * @param[in] len Length of the topic filter
+ * @param[in] pos Start of the level to descend into
+ * @param[in] client Subscriber identifier
+ * @return 1 if a subscription was removed, 0 otherwise
+ */
+static int unsubscribe(struct sub_trie *trie, struct trie_node *node,
+		       const unsigned char *filter, size_t len, size_t pos,
+		       unsigned client)
+{
+	size_t end = level_end(filter, len, pos);
+	struct trie_node **slot = child_slot(node, filter + pos, end - pos);
+	if (!slot || !*slot)
+		return 0;
+	struct trie_node *child = *slot;
+
+	int removed = 0;
+	if (end < len) {
+		removed = unsubscribe(trie, child, filter, len, end + 1, client);
+	} else {
+		for (size_t i = 0; i < child->subs.len; i++) {
+			if (child->subs.subs[i].client == client) {
+				child->subs.subs[i] =
+					child->subs.subs[--child->subs.len];
+				child->generation = ++trie->clock;
+				removed = 1;
+				break;
+			}
+		}
+	}
+	if (!removed || !node_empty(child))
+		return removed;
+
+	// Walks that reached the child recorded the parent generation that
+	// covers it, bumping that one keeps them off the freed node
+	if (slot == &node->one || slot == &node->all) {
+		*slot = NULL;
+		node->generation = ++trie->clock;
+	} else {
+		size_t i = slot - node->children;
+		memmove(&node->children[i], &node->children[i + 1],
+			(node->nchildren - i - 1) * sizeof(*node->children));
+		node->nchildren--;
+		*child_gen(node, filter + pos, end - pos) = ++trie->clock;
+	}
+	node_free(child);
+	trie->nodes--;
+	return 1;
+}
+
+int trie_unsubscribe(struct sub_trie *trie, const unsigned char *filter,
+		     size_t len, unsigned client)
+{
+	return unsubscribe(trie, &trie->root, filter, len, 0, client);
+}
+
+/**
+ * @brief Recursive match walk
+ *
+ * @param[in] node Node reached so far
+ * @param[in] topic Topic name
+ * @param[in] len Length of the topic name
+ * @param[in] pos Start of the next level, len + 1 once every level is consumed
+ * @param[in] wildcards Zero at the root of a '$' topic, which wildcards must
+ *            not match
+ * @param[out] out Set receiving the subscribers
+ * @param[out] path Visited nodes, may be NULL
+ * @return 0 on success, -1 on allocation failure
+ */
+static int walk(struct trie_node *node, const unsigned char *topic,
+		size_t len, size_t pos, int wildcards, struct sub_set *out,
+		struct trie_path *path)
+{
+	if (path_push(path, &node->generation) == -1)
+		return -1;
+
+	// '#' also matches the parent level, so check it before the end test
+	if (wildcards && node->all &&
+	    (path_push(path, &node->all->generation) == -1 ||
+	     sub_set_append(out, &node->all->subs) == -1))
+		return -1;
+
+	if (pos > len)
+		return sub_set_append(out, &node->subs);
+
+	// Topic levels are always literal, even a '+' or '#' byte
+	size_t end = level_end(topic, len, pos);
+	int found;
+	size_t i = child_search(node, topic + pos, end - pos, &found);
+	if (path_push(path, child_gen(node, topic + pos, end - pos)) == -1)
+		return -1;
+	if (found && walk(node->children[i], topic, len, end + 1, 1, out,
+			  path) == -1)
+		return -1;
+	if (wildcards && node->one &&
+	    walk(node->one, topic, len, end + 1, 1, out, path) == -1)
+		return -1;
+	return 0;
+}
+
+int trie_match(const struct sub_trie *trie, const unsigned char *topic,
+	       size_t len, struct sub_set *out, struct trie_path *path)
+{
+	TRACE_BEGIN(start);
+	out->len = 0;
+	if (path)
+		path->len = 0;
+
+	int wildcards = !(len > 0 && topic[0] == '$');
+	if (walk((struct trie_node *)&trie->root, topic, len, 0, wildcards,
+		 out, path) == -1)
+		return -1;
+	sub_set_dedup(out);
+	TRACE_END(start, TRACE_ROUTE, PUBLISH);
+	return 0;
+}
+
+void trie_destroy(struct sub_trie *trie)
+{
+	for (size_t i = 0; i < trie->root.nchildren; i++)
+		node_free(trie->root.children[i]);
+	if (trie->root.one)
+		node_free(trie->root.one);
+	if (trie->root.all)
+		node_free(trie->root.all);
+	free(trie->root.children);
+	sub_set_release(&trie->root.subs);
+	trie_init(trie);
+}
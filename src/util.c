@@ -0,0 +1,22 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include "../include/util.h"
+
+/**
+ * @file util.c
+ * @brief Implementation of the shared helpers
+ */
+
+uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t monotonic_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
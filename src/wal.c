@@ -0,0 +1,328 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/wal.h"
+#include "../include/pack.h"
+#include "../include/util.h"
+
+/**
+ * @file wal.c
+ * @brief Implementation of the group-commit write-ahead log
+ *
+ * Appenders and the writer thread share two batches. Appenders fill the
+ * active batch under the lock. The writer waits for the commit window to
+ * expire, swaps the batches, and writes and syncs the flushing batch without
+ * holding the lock, so appends keep flowing while the disk is busy.
+ *
+ * Once a commit fails the writer stops touching the file. It keeps draining
+ * the batches only to report their records as failed.
+ */
+
+/** Size of the per-record header, body length plus checksum */
+#define RECORD_HEADER_LEN (2 * sizeof(uint32_t))
+
+/** Size of a record body without its topic and payload bytes */
+#define RECORD_FIXED_LEN (sizeof(uint8_t) + 2 * sizeof(uint16_t) + \
+			  sizeof(uint32_t))
+
+/**
+ * @brief Returns the absolute CLOCK_REALTIME deadline window_us from now
+ */
+static struct timespec deadline_after(unsigned long window_us)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += window_us / 1000000;
+	ts.tv_nsec += (window_us % 1000000) * 1000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	return ts;
+}
+
+/**
+ * @brief Writes a whole buffer to the log, retrying on short writes
+ */
+static int write_all(int fd, const unsigned char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * @brief Writes and syncs the flushing batch, then fires its callbacks
+ *
+ * Called by the writer thread without the lock held. The writer is the only
+ * thread setting wal->error, so it can read it without the lock.
+ */
+static void commit_batch(struct wal *wal)
+{
+	struct wal_batch *batch = &wal->flushing;
+	int error = wal->error;
+	if (!error && (write_all(wal->fd, batch->buf, batch->len) == -1 ||
+		       fdatasync(wal->fd) == -1))
+		error = errno;
+
+	pthread_mutex_lock(&wal->lock);
+	if (error) {
+		wal->error = error;
+	} else {
+		wal->stats.commits++;
+		wal->stats.records += batch->nwaiters;
+		wal->stats.bytes += batch->len;
+	}
+	pthread_mutex_unlock(&wal->lock);
+
+	for (size_t i = 0; i < batch->nwaiters; i++)
+		if (batch->waiters[i].cb)
+			batch->waiters[i].cb(batch->waiters[i].seq, error,
+					     batch->waiters[i].arg);
+
+	batch->len = 0;
+	batch->nwaiters = 0;
+}
+
+/**
+ * @brief Writer thread main loop
+ *
+ * Sleeps until the first record of a batch arrives, then keeps collecting
+ * until the commit window expires, the batch grows past WAL_MAX_BATCH or the
+ * log is closed.
+ */
+static void *writer_loop(void *arg)
+{
+	struct wal *wal = arg;
+
+	pthread_mutex_lock(&wal->lock);
+	for (;;) {
+		while (wal->running && wal->active.nwaiters == 0)
+			pthread_cond_wait(&wal->cond, &wal->lock);
+		if (wal->active.nwaiters == 0)
+			break;
+
+		if (wal->window_us > 0) {
+			struct timespec ts = deadline_after(wal->window_us);
+			while (wal->running && wal->active.len < WAL_MAX_BATCH &&
+			       pthread_cond_timedwait(&wal->cond, &wal->lock,
+						      &ts) != ETIMEDOUT)
+				;
+		}
+
+		struct wal_batch tmp = wal->flushing;
+		wal->flushing = wal->active;
+		wal->active = tmp;
+
+		pthread_mutex_unlock(&wal->lock);
+		commit_batch(wal);
+		pthread_mutex_lock(&wal->lock);
+	}
+	pthread_mutex_unlock(&wal->lock);
+	return NULL;
+}
+
+int wal_open(struct wal *wal, const char *path, unsigned long window_us)
+{
+	memset(wal, 0, sizeof(*wal));
+	wal->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (wal->fd == -1)
+		return -1;
+	wal->window_us = window_us;
+	wal->running = 1;
+	wal->next_seq = 1;
+	pthread_mutex_init(&wal->lock, NULL);
+	pthread_cond_init(&wal->cond, NULL);
+	if (pthread_create(&wal->writer, NULL, writer_loop, wal) != 0) {
+		close(wal->fd);
+		pthread_mutex_destroy(&wal->lock);
+		pthread_cond_destroy(&wal->cond);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Grows the active batch so that it fits one more record of n bytes
+ */
+static int batch_reserve(struct wal_batch *batch, size_t n)
+{
+	if (batch->len + n > batch->cap) {
+		size_t cap = batch->cap ? batch->cap : 65536;
+		while (cap < batch->len + n)
+			cap *= 2;
+		unsigned char *buf = realloc(batch->buf, cap);
+		if (!buf)
+			return -1;
+		batch->buf = buf;
+		batch->cap = cap;
+	}
+	if (batch->nwaiters == batch->wcap) {
+		size_t wcap = batch->wcap ? batch->wcap * 2 : 256;
+		void *waiters =
+			realloc(batch->waiters, wcap * sizeof(*batch->waiters));
+		if (!waiters)
+			return -1;
+		batch->waiters = waiters;
+		batch->wcap = wcap;
+	}
+	return 0;
+}
+
+uint64_t wal_append(struct wal *wal, const struct mqtt_publish *pkt,
+		    wal_durable_cb cb, void *arg)
+{
+	size_t body = RECORD_FIXED_LEN + pkt->topiclen + pkt->payloadlen;
+	uint64_t seq = 0;
+
+	pthread_mutex_lock(&wal->lock);
+	if (!wal->running || wal->error ||
+	    batch_reserve(&wal->active, RECORD_HEADER_LEN + body) == -1)
+		goto out;
+
+	struct wal_batch *batch = &wal->active;
+	uint8_t *start = batch->buf + batch->len;
+	uint8_t *ptr = start + RECORD_HEADER_LEN;
+	pack_u8(&ptr, pkt->header.byte);
+	pack_u16(&ptr, pkt->pkt_id);
+	pack_string16(&ptr, pkt->topic, pkt->topiclen);
+	pack_u32(&ptr, pkt->payloadlen);
+	pack_nbytes(&ptr, pkt->payload, pkt->payloadlen);
+
+	ptr = start;
+	pack_u32(&ptr, body);
+	pack_u32(&ptr, fnv1a(start + RECORD_HEADER_LEN, body));
+	batch->len += RECORD_HEADER_LEN + body;
+
+	seq = wal->next_seq++;
+	batch->waiters[batch->nwaiters].cb = cb;
+	batch->waiters[batch->nwaiters].arg = arg;
+	batch->waiters[batch->nwaiters].seq = seq;
+	// Only the first record of a batch needs to wake the writer
+	if (batch->nwaiters++ == 0 || batch->len >= WAL_MAX_BATCH)
+		pthread_cond_signal(&wal->cond);
+out:
+	pthread_mutex_unlock(&wal->lock);
+	return seq;
+}
+
+int wal_close(struct wal *wal)
+{
+	pthread_mutex_lock(&wal->lock);
+	wal->running = 0;
+	pthread_cond_signal(&wal->cond);
+	pthread_mutex_unlock(&wal->lock);
+	pthread_join(wal->writer, NULL);
+
+	free(wal->active.buf);
+	free(wal->active.waiters);
+	free(wal->flushing.buf);
+	free(wal->flushing.waiters);
+	pthread_mutex_destroy(&wal->lock);
+	pthread_cond_destroy(&wal->cond);
+	close(wal->fd);
+	return wal->error ? -1 : 0;
+}
+
+/**
+ * @brief Reads a whole file, *size receives its length
+ *
+ * Reads until EOF rather than trusting the size reported by fstat, which a
+ * short read or a file still growing would make wrong.
+ */
+static unsigned char *read_file(const char *path, size_t *size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	struct stat st;
+	size_t cap = 4096, len = 0;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		cap = (size_t)st.st_size + 1;
+	unsigned char *buf = malloc(cap);
+
+	while (buf) {
+		if (len == cap) {
+			unsigned char *grown = realloc(buf, cap * 2);
+			if (!grown) {
+				free(buf);
+				buf = NULL;
+				break;
+			}
+			buf = grown;
+			cap *= 2;
+		}
+		ssize_t n = read(fd, buf + len, cap - len);
+		if (n == 0)
+			break;
+		if (n > 0) {
+			len += n;
+		} else if (errno != EINTR) {
+			int saved = errno;
+			free(buf);
+			buf = NULL;
+			errno = saved;
+		}
+	}
+	close(fd);
+	*size = len;
+	return buf;
+}
+
+long wal_replay(const char *path, wal_replay_cb cb, void *arg)
+{
+	size_t size;
+	unsigned char *buf = read_file(path, &size);
+	if (!buf)
+		return -1;
+
+	const uint8_t *ptr = buf;
+	const uint8_t *end = buf + size;
+	long count = 0;
+
+	while (end - ptr >= (long)RECORD_HEADER_LEN) {
+		uint32_t body = unpack_u32(&ptr);
+		uint32_t sum = unpack_u32(&ptr);
+		if (end - ptr < (long)body || body < RECORD_FIXED_LEN ||
+		    fnv1a(ptr, body) != sum)
+			break;
+
+		// Lengths that disagree with the body are corruption as well
+		const uint8_t *rec = ptr;
+		struct mqtt_publish pkt;
+		pkt.header.byte = unpack_u8(&rec);
+		pkt.pkt_id = unpack_u16(&rec);
+		pkt.topiclen = unpack_u16(&rec);
+		if (pkt.topiclen > body - RECORD_FIXED_LEN)
+			break;
+		pkt.topic = (unsigned char *)rec;
+		rec += pkt.topiclen;
+		uint32_t payloadlen = unpack_u32(&rec);
+		if (payloadlen != body - RECORD_FIXED_LEN - pkt.topiclen)
+			break;
+		pkt.payloadlen = payloadlen;
+		pkt.payload = (unsigned char *)rec;
+		if (cb)
+			cb(&pkt, arg);
+
+		ptr += body;
+		count++;
+	}
+
+	free(buf);
+	return count;
+}
@@ -0,0 +1,258 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "../include/zerocopy.h"
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+#define HAVE_ZEROCOPY 1
+#else
+#define HAVE_ZEROCOPY 0
+#endif
+
+/**
+ * @file zerocopy.c
+ * @brief Implementation of the MSG_ZEROCOPY send path
+ *
+ * The kernel numbers every successful MSG_ZEROCOPY send on a socket with a
+ * consecutive 32-bit ID and later reports completed ranges [lo, hi] on the
+ * socket error queue. Pending sends are kept in a ring in ID order, so a
+ * completion releases the payload references of the sends it covers. A
+ * completion flagged SO_EE_CODE_ZEROCOPY_COPIED means the kernel copied the
+ * data after all, loopback always does, and is accounted as copied.
+ */
+
+struct zc_buf *zc_buf_new(const unsigned char *data, size_t len)
+{
+	struct zc_buf *buf = malloc(sizeof(*buf) + len);
+	if (!buf)
+		return NULL;
+	atomic_init(&buf->refcount, 1);
+	buf->len = len;
+	memcpy(buf->data, data, len);
+	return buf;
+}
+
+struct zc_buf *zc_buf_get(struct zc_buf *buf)
+{
+	atomic_fetch_add(&buf->refcount, 1);
+	return buf;
+}
+
+void zc_buf_put(struct zc_buf *buf)
+{
+	if (atomic_fetch_sub(&buf->refcount, 1) == 1)
+		free(buf);
+}
+
+int zc_socket_init(struct zc_socket *zs, int fd, size_t threshold)
+{
+	memset(zs, 0, sizeof(*zs));
+	zs->fd = fd;
+	zs->threshold = threshold;
+#if HAVE_ZEROCOPY
+	int one = 1;
+	zs->enabled = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one,
+				 sizeof(one)) == 0;
+#endif
+	return 0;
+}
+
+/**
+ * @brief Makes room for one more pending send in the ring
+ */
+static int pending_reserve(struct zc_socket *zs)
+{
+	if (zs->npending < zs->cap)
+		return 0;
+	size_t cap = zs->cap ? zs->cap * 2 : 64;
+	void *pending = realloc(zs->pending, cap * sizeof(*zs->pending));
+	if (!pending)
+		return -1;
+	zs->pending = pending;
+	// The ring is full, move its wrapped part behind the old end
+	memcpy(&zs->pending[zs->cap], &zs->pending[0],
+	       zs->head * sizeof(*zs->pending));
+	zs->cap = cap;
+	return 0;
+}
+
+/**
+ * @brief Sends the payload from off on with MSG_ZEROCOPY, one send call
+ *
+ * A successful send consumes a notification ID and pins buf until that ID
+ * is reported complete.
+ */
+static ssize_t send_zerocopy(struct zc_socket *zs, struct zc_buf *buf,
+			     size_t off)
+{
+	if (pending_reserve(zs) == -1) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	int flags = MSG_NOSIGNAL;
+#if HAVE_ZEROCOPY
+	flags |= MSG_ZEROCOPY;
+#endif
+	ssize_t n = send(zs->fd, buf->data + off, buf->len - off, flags);
+	if (n == -1)
+		return -1;
+	size_t slot = (zs->head + zs->npending) % zs->cap;
+	zs->pending[slot].seq = zs->next_seq++;
+	zs->pending[slot].len = n;
+	zs->pending[slot].buf = zc_buf_get(buf);
+	zs->npending++;
+	return n;
+}
+
+/**
+ * @brief Sends the rest of the frame from off on by copy, one sendmsg call
+ *
+ * Header and payload go out in a single call, so a short write never
+ * leaves the kernel with a header it may transmit on its own.
+ */
+static ssize_t send_copy(struct zc_socket *zs, const unsigned char *hdr,
+			 size_t hdrlen, struct zc_buf *buf, size_t off)
+{
+	struct iovec iov[2];
+	int iovcnt = 0;
+	if (off < hdrlen) {
+		iov[iovcnt].iov_base = (void *)(hdr + off);
+		iov[iovcnt++].iov_len = hdrlen - off;
+		off = 0;
+	} else {
+		off -= hdrlen;
+	}
+	iov[iovcnt].iov_base = buf->data + off;
+	iov[iovcnt++].iov_len = buf->len - off;
+
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+	ssize_t n = sendmsg(zs->fd, &msg, MSG_NOSIGNAL);
+	if (n > 0)
+		zs->stats.copied_bytes += n;
+	return n;
+}
+
+ssize_t zc_send(struct zc_socket *zs, const unsigned char *hdr, size_t hdrlen,
+		struct zc_buf *payload, size_t offset)
+{
+	size_t total = hdrlen + payload->len;
+	int zerocopy = zs->enabled && payload->len >= zs->threshold;
+	size_t sent = 0;
+
+	while (offset + sent < total) {
+		size_t off = offset + sent;
+		ssize_t n;
+		if (!zerocopy) {
+			n = send_copy(zs, hdr, hdrlen, payload, off);
+		} else if (off < hdrlen) {
+			// The header lives in the caller's memory and is always
+			// copied, MSG_MORE coalesces it with the payload
+			n = send(zs->fd, hdr + off, hdrlen - off,
+				 MSG_NOSIGNAL | MSG_MORE);
+			if (n > 0)
+				zs->stats.copied_bytes += n;
+		} else {
+			n = send_zerocopy(zs, payload, off - hdrlen);
+			// Out of pinnable pages or ring slots, copy the rest
+			if (n == -1 && errno == ENOBUFS) {
+				zerocopy = 0;
+				continue;
+			}
+		}
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			// Report what went out, the caller resumes from there
+			return sent > 0 ? (ssize_t)sent : -1;
+		}
+		sent += n;
+	}
+	return sent;
+}
+
+/**
+ * @brief Releases every pending send whose ID lies in [lo, hi]
+ */
+static int complete_range(struct zc_socket *zs, uint32_t lo, uint32_t hi,
+			  int copied)
+{
+	int completed = 0;
+	for (size_t i = 0; i < zs->npending; i++) {
+		size_t slot = (zs->head + i) % zs->cap;
+		struct zc_buf *buf = zs->pending[slot].buf;
+		// Unsigned arithmetic keeps the test correct across wraparound
+		if (!buf || zs->pending[slot].seq - lo > hi - lo)
+			continue;
+		if (copied)
+			zs->stats.copied_bytes += zs->pending[slot].len;
+		else
+			zs->stats.zerocopy_bytes += zs->pending[slot].len;
+		zc_buf_put(buf);
+		zs->pending[slot].buf = NULL;
+		completed++;
+	}
+	while (zs->npending > 0 && !zs->pending[zs->head].buf) {
+		zs->head = (zs->head + 1) % zs->cap;
+		zs->npending--;
+	}
+	return completed;
+}
+
+int zc_reap(struct zc_socket *zs)
+{
+	int completed = 0;
+#if HAVE_ZEROCOPY
+	for (;;) {
+		char control[128];
+		struct msghdr msg = { .msg_control = control,
+				      .msg_controllen = sizeof(control) };
+		if (recvmsg(zs->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -1;
+		}
+
+		struct cmsghdr *cm;
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!(cm->cmsg_level == SOL_IP &&
+			      cm->cmsg_type == IP_RECVERR) &&
+			    !(cm->cmsg_level == SOL_IPV6 &&
+			      cm->cmsg_type == IPV6_RECVERR))
+				continue;
+			struct sock_extended_err serr;
+			memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+			if (serr.ee_errno != 0 ||
+			    serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			zs->stats.completions++;
+			completed += complete_range(
+				zs, serr.ee_info, serr.ee_data,
+				serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+		}
+	}
+#else
+	(void)zs;
+#endif
+	return completed;
+}
+
+int zc_socket_release(struct zc_socket *zs)
+{
+	if (zs->npending > 0 && zc_reap(zs) == -1)
+		return -1;
+	if (zs->npending > 0) {
+		errno = EBUSY;
+		return -1;
+	}
+	free(zs->pending);
+	zs->pending = NULL;
+	zs->head = zs->cap = 0;
+	return 0;
+}
@@ -0,0 +1,222 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "../include/auth.h"
+
+struct results {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int done;
+	int accepted;
+};
+
+// Holds verifications back until the test opens it
+struct gate {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int open;
+	int entered;
+};
+
+static struct results results = { PTHREAD_MUTEX_INITIALIZER,
+				  PTHREAD_COND_INITIALIZER, 0, 0 };
+static struct gate gate = { PTHREAD_MUTEX_INITIALIZER,
+			    PTHREAD_COND_INITIALIZER, 1, 0 };
+static int verify_calls;
+static uint64_t fake_now_ns;
+
+static uint64_t fake_clock(void)
+{
+	return fake_now_ns;
+}
+
+static void gate_set(int open)
+{
+	pthread_mutex_lock(&gate.lock);
+	gate.open = open;
+	gate.entered = 0;
+	pthread_cond_broadcast(&gate.cond);
+	pthread_mutex_unlock(&gate.lock);
+}
+
+static void gate_wait_entered(int n)
+{
+	pthread_mutex_lock(&gate.lock);
+	while (gate.entered < n)
+		pthread_cond_wait(&gate.cond, &gate.lock);
+	pthread_mutex_unlock(&gate.lock);
+}
+
+// Stands in for a deliberately slow password hash such as bcrypt
+static int slow_verify(const unsigned char *username, size_t ulen,
+		       const unsigned char *password, size_t plen, void *arg)
+{
+	(void)username;
+	(void)ulen;
+	(void)arg;
+	__atomic_add_fetch(&verify_calls, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&gate.lock);
+	gate.entered++;
+	pthread_cond_broadcast(&gate.cond);
+	while (!gate.open)
+		pthread_cond_wait(&gate.cond, &gate.lock);
+	pthread_mutex_unlock(&gate.lock);
+	return plen == 6 && memcmp(password, "secret", 6) == 0;
+}
+
+// Stands in for handing the CONNACK back to the connection's thread
+static void on_done(int ok, void *arg)
+{
+	struct results *r = arg;
+	pthread_mutex_lock(&r->lock);
+	r->done++;
+	r->accepted += ok;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void wait_done(struct results *r, int n)
+{
+	pthread_mutex_lock(&r->lock);
+	while (r->done < n)
+		pthread_cond_wait(&r->cond, &r->lock);
+	pthread_mutex_unlock(&r->lock);
+}
+
+static int submit(struct auth_pool *pool, const char *user, const char *pass)
+{
+	return auth_submit(pool, (const unsigned char *)user, strlen(user),
+			   (const unsigned char *)pass, strlen(pass), on_done,
+			   &results);
+}
+
+void test_offload(void)
+{
+	printf("Testing verification offload...\n");
+
+	struct auth_pool pool;
+	// A pool without workers would never answer
+	assert(auth_pool_init(&pool, 0, slow_verify, NULL,
+			      AUTH_DEFAULT_MAX_QUEUED, 64, 60000) == -1);
+	assert(auth_pool_init(&pool, 4, slow_verify, NULL,
+			      AUTH_DEFAULT_MAX_QUEUED, 64, 60000) == 0);
+
+	// Submitting returns while every verification is still held back
+	gate_set(0);
+	for (int i = 0; i < 8; i++) {
+		char user[16];
+		snprintf(user, sizeof(user), "client%d", i);
+		assert(submit(&pool, user, "secret") == AUTH_PENDING);
+	}
+	assert(submit(&pool, "client0", "wrong") == AUTH_PENDING);
+	assert(results.done == 0);
+
+	gate_set(1);
+	wait_done(&results, 9);
+	assert(results.accepted == 8);
+
+	auth_pool_destroy(&pool);
+	printf("✓ Verification offload tests passed\n\n");
+}
+
+void test_queue_bound(void)
+{
+	printf("Testing the job queue bound...\n");
+
+	struct auth_pool pool;
+	assert(auth_pool_init(&pool, 1, slow_verify, NULL, 2, 0, 0) == 0);
+	results.done = results.accepted = 0;
+
+	// The only worker is busy, two more jobs fit the queue
+	gate_set(0);
+	assert(submit(&pool, "client", "secret") == AUTH_PENDING);
+	gate_wait_entered(1);
+	assert(submit(&pool, "client", "secret") == AUTH_PENDING);
+	assert(submit(&pool, "client", "secret") == AUTH_PENDING);
+	errno = 0;
+	assert(submit(&pool, "client", "secret") == -1);
+	assert(errno == EAGAIN);
+
+	gate_set(1);
+	wait_done(&results, 3);
+	assert(pool.queued == 0);
+	assert(submit(&pool, "client", "secret") == AUTH_PENDING);
+	wait_done(&results, 4);
+
+	auth_pool_destroy(&pool);
+	printf("✓ Queue bound tests passed\n\n");
+}
+
+void test_cache(void)
+{
+	printf("Testing credential cache...\n");
+
+	struct auth_pool pool;
+	assert(auth_pool_init(&pool, 2, slow_verify, NULL,
+			      AUTH_DEFAULT_MAX_QUEUED, 64, 100) == 0);
+	pool.cache.now = fake_clock;
+	results.done = results.accepted = 0;
+	verify_calls = 0;
+
+	assert(submit(&pool, "client", "secret") == AUTH_PENDING);
+	assert(submit(&pool, "client", "wrong") == AUTH_PENDING);
+	wait_done(&results, 2);
+	assert(results.accepted == 1);
+
+	// Reconnects are served inline, failures are never cached
+	assert(submit(&pool, "client", "secret") == AUTH_CACHED);
+	assert(submit(&pool, "client", "wrong") == AUTH_PENDING);
+	assert(submit(&pool, "clien", "tsecret") == AUTH_PENDING);
+	wait_done(&results, 4);
+	assert(verify_calls == 4);
+	assert(pool.cache.hits == 1);
+
+	// Still cached right before the 100 ms TTL ends, expired at its end
+	fake_now_ns += 99 * 1000000;
+	assert(submit(&pool, "client", "secret") == AUTH_CACHED);
+	fake_now_ns += 1000000;
+	assert(submit(&pool, "client", "secret") == AUTH_PENDING);
+	wait_done(&results, 5);
+
+	// Checked last: the cache is direct-mapped under a random key, so this
+	// entry may take the slot of the one above
+	assert(submit(&pool, "other", "secret") == AUTH_PENDING);
+	wait_done(&results, 6);
+
+	auth_pool_destroy(&pool);
+	printf("✓ Credential cache tests passed\n\n");
+}
+
+void test_destroy_drains(void)
+{
+	printf("Testing shutdown with queued jobs...\n");
+
+	struct auth_pool pool;
+	assert(auth_pool_init(&pool, 1, slow_verify, NULL,
+			      AUTH_DEFAULT_MAX_QUEUED, 0, 0) == 0);
+	results.done = results.accepted = 0;
+
+	for (int i = 0; i < 5; i++)
+		assert(submit(&pool, "client", "secret") == AUTH_PENDING);
+	auth_pool_destroy(&pool);
+	assert(results.done == 5);
+
+	printf("✓ Shutdown tests passed\n\n");
+}
+
+int main(void)
+{
+	printf("Running auth module unit tests\n");
+	printf("=============================\n\n");
+
+	test_offload();
+	test_queue_bound();
+	test_cache();
+	test_destroy_drains();
+
+	printf("All tests passed!\n");
+	return 0;
+}
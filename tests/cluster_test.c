@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "../include/cluster.h"
+#include "../include/network.h"
+
+static struct mqtt_publish make_publish(const char *topic, const char *payload)
+{
+	struct mqtt_publish pkt = { .header = { .byte = PUBLISH_BYTE } };
+	pkt.pkt_id = 0;
+	pkt.topiclen = strlen(topic);
+	pkt.topic = (unsigned char *)topic;
+	pkt.payloadlen = strlen(payload);
+	pkt.payload = (unsigned char *)payload;
+	return pkt;
+}
+
+static void add(struct cluster_summary *summary, const char *filter)
+{
+	cluster_summary_add(summary, (const unsigned char *)filter,
+			    strlen(filter));
+}
+
+void test_summary_aggregation(void)
+{
+	printf("Testing cluster_summary_add aggregation...\n");
+
+	struct cluster_summary summary;
+	cluster_summary_init(&summary);
+
+	add(&summary, "sensors/1/temp");
+	add(&summary, "sensors/2/temp");
+	assert(summary.len == 2);
+
+	// Broader filter replaces both narrower ones
+	add(&summary, "sensors/+/temp");
+	assert(summary.len == 1);
+
+	// Already covered, nothing changes
+	assert(cluster_summary_add(&summary,
+				   (const unsigned char *)"sensors/9/temp",
+				   14) == 0);
+	assert(summary.len == 1);
+
+	add(&summary, "cameras/#");
+	assert(summary.len == 2);
+
+	assert(cluster_summary_match(&summary,
+				     (const unsigned char *)"cameras/front", 13));
+	assert(!cluster_summary_match(&summary,
+				      (const unsigned char *)"sensors/1/hum",
+				      13));
+
+	cluster_summary_clear(&summary);
+	printf("✓ cluster_summary_add aggregation tests passed\n\n");
+}
+
+void test_summary_all_or_nothing(void)
+{
+	printf("Testing cluster_batch_add_summary on a full batch...\n");
+
+	struct cluster_summary summary;
+	cluster_summary_init(&summary);
+	add(&summary, "a/#");
+	add(&summary, "b/#");
+	add(&summary, "c/#");
+
+	struct cluster_batch batch;
+	cluster_batch_init(&batch);
+	struct mqtt_publish pkt = make_publish("x", "y");
+	assert(cluster_batch_add_publish(&batch, &pkt) == 0);
+	size_t len = batch.len;
+
+	// Room for the reset and two filters only, nothing may be appended
+	batch.count = UINT16_MAX - 3;
+	assert(cluster_batch_add_summary(&batch, &summary) == -1);
+	assert(batch.len == len);
+	assert(batch.count == UINT16_MAX - 3);
+
+	batch.count = UINT16_MAX - 4;
+	assert(cluster_batch_add_summary(&batch, &summary) == 0);
+	assert(batch.count == UINT16_MAX);
+	assert(batch.len == len + 1 + 3 * (3 + 3));
+
+	free(batch.buf);
+	cluster_summary_clear(&summary);
+	printf("✓ cluster_batch_add_summary all-or-nothing tests passed\n\n");
+}
+
+void test_decode_rejects_truncated(void)
+{
+	printf("Testing cluster_decode on malformed frames...\n");
+
+	struct cluster_peer peer;
+	cluster_peer_init(&peer, -1);
+
+	struct mqtt_publish pkt = make_publish("a/b", "hello");
+	cluster_batch_add_publish(&peer.out, &pkt);
+
+	// Body starts after the u32 length prefix
+	const unsigned char *body = peer.out.buf + sizeof(uint32_t);
+	size_t len = peer.out.len - sizeof(uint32_t);
+	unsigned char *ptr = peer.out.buf + sizeof(uint32_t);
+	ptr[0] = 0;
+	ptr[1] = 1; // record count
+
+	assert(cluster_decode(&peer, body, len, NULL, NULL) == 1);
+	for (size_t cut = 0; cut < len; cut++)
+		assert(cluster_decode(&peer, body, cut, NULL, NULL) == -1);
+
+	cluster_peer_release(&peer);
+	printf("✓ cluster_decode malformed frame tests passed\n\n");
+}
+
+struct received {
+	int count;
+	char topics[8][32];
+};
+
+static void on_publish(struct cluster_peer *peer,
+		       const struct mqtt_publish *pkt, void *arg)
+{
+	(void)peer;
+	struct received *r = arg;
+	assert(pkt->topiclen < sizeof(r->topics[0]));
+	memcpy(r->topics[r->count], pkt->topic, pkt->topiclen);
+	r->topics[r->count][pkt->topiclen] = '\0';
+	r->count++;
+}
+
+// Runs as a separate process, announces interest and checks that only the
+// matching messages arrive
+static int run_remote_node(const char *port)
+{
+	int fd = make_connection("127.0.0.1", port);
+	if (fd == -1)
+		return 1;
+
+	struct cluster_peer peer;
+	cluster_peer_init(&peer, fd);
+
+	struct cluster_summary local;
+	cluster_summary_init(&local);
+	add(&local, "sensors/+/temp");
+	if (cluster_peer_announce(&peer, &local) == -1)
+		return 2;
+
+	struct received r = { 0 };
+	if (cluster_peer_recv(&peer, on_publish, &r) != 2)
+		return 3;
+	if (r.count != 2 || strcmp(r.topics[0], "sensors/1/temp") != 0 ||
+	    strcmp(r.topics[1], "sensors/2/temp") != 0)
+		return 4;
+
+	cluster_summary_clear(&local);
+	cluster_peer_release(&peer);
+	close(fd);
+	return 0;
+}
+
+void test_loopback_forwarding(void)
+{
+	printf("Testing cluster forwarding between processes...\n");
+
+	int lfd = make_listen("127.0.0.1", "0");
+	assert(lfd != -1);
+	char port[8];
+	snprintf(port, sizeof(port), "%d", socket_port(lfd));
+
+	pid_t pid = fork();
+	assert(pid != -1);
+	if (pid == 0) {
+		close(lfd);
+		_exit(run_remote_node(port));
+	}
+
+	int fd = accept(lfd, NULL, NULL);
+	assert(fd != -1);
+
+	struct cluster_peer peer;
+	cluster_peer_init(&peer, fd);
+
+	// Receive the remote summary: one reset plus one filter
+	assert(cluster_peer_recv(&peer, NULL, NULL) == 2);
+	assert(peer.remote.len == 1);
+
+	struct mqtt_publish msgs[] = {
+		make_publish("sensors/1/temp", "21.5"),
+		make_publish("sensors/1/hum", "40"),
+		make_publish("sensors/2/temp", "19.0"),
+	};
+	int queued = 0;
+	for (size_t i = 0; i < sizeof(msgs) / sizeof(msgs[0]); i++)
+		queued += cluster_peer_forward(&peer, &msgs[i]);
+	assert(queued == 2);
+
+	// Both messages leave in one frame
+	assert(peer.out.count == 2);
+	assert(cluster_peer_flush(&peer) == 0);
+
+	int status;
+	waitpid(pid, &status, 0);
+	printf("  remote node exit status %d\n", WEXITSTATUS(status));
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	cluster_peer_release(&peer);
+	close(fd);
+	close(lfd);
+	printf("✓ cluster forwarding tests passed\n\n");
+}
+
+int main(void)
+{
+	printf("Running cluster module unit tests\n");
+	printf("================================\n\n");
+
+	test_summary_aggregation();
+	test_summary_all_or_nothing();
+	test_decode_rejects_truncated();
+	test_loopback_forwarding();
+
+	printf("All tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,249 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "../include/connection.h"
+#include "../include/mqtt.h"
+#include "../include/network.h"
+
+#define MAX_CONNECTIONS 5000
+#define IDLE_BUDGET 1024
+
+static long resident_bytes(void)
+{
+	long size, resident;
+	FILE *f = fopen("/proc/self/statm", "r");
+	assert(f);
+	assert(fscanf(f, "%ld %ld", &size, &resident) == 2);
+	fclose(f);
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void open_pair(struct connection *conn, int *peer)
+{
+	int fds[2];
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	assert(set_nonblocking(fds[0]) == 0);
+	conn_init(conn, fds[0]);
+	*peer = fds[1];
+}
+
+void test_buffers(void)
+{
+	printf("Testing lazily held buffers...\n");
+
+	struct connection conn;
+	int peer;
+	open_pair(&conn, &peer);
+	assert(conn.rbuf == NULL && conn.wbuf == NULL);
+
+	// Nothing to read keeps no buffer
+	assert(conn_recv(&conn) == -1 && errno == EAGAIN);
+	assert(conn.rbuf == NULL);
+
+	// A frame larger than a pooled buffer grows the read buffer
+	size_t big = 3 * CONN_BUF_SIZE;
+	unsigned char *frame = malloc(big);
+	for (size_t i = 0; i < big; i++)
+		frame[i] = i & 0xff;
+	assert(send_bytes(peer, frame, big) == (ssize_t)big);
+	size_t len = 0;
+	while (len < big) {
+		assert(conn_recv(&conn) > 0);
+		conn_pending(&conn, &len);
+	}
+	const unsigned char *data = conn_pending(&conn, &len);
+	assert(len == big && memcmp(data, frame, big) == 0);
+	conn_consume(&conn, 10);
+	data = conn_pending(&conn, &len);
+	assert(len == big - 10 && data[0] == 10);
+	conn_consume(&conn, len);
+	assert(conn.rbuf == NULL);
+
+	// Grown buffers are freed, only standard ones are pooled
+	size_t idle = conn_pool_idle();
+	assert(conn_queue(&conn, frame, 100) == 0);
+	assert(conn_pool_idle() == idle - (idle > 0));
+	assert(conn_flush(&conn) == 0);
+	assert(conn.wbuf == NULL);
+	assert(recv_bytes(peer, frame, 100) == 100);
+
+	// Pending output is bounded by the maximum packet size
+	unsigned char *huge = calloc(1, CONN_MAX_PACKET + 1);
+	assert(conn_queue(&conn, huge, CONN_MAX_PACKET + 1) == -1);
+	assert(errno == EMSGSIZE);
+	assert(conn_queue(&conn, huge, CONN_MAX_PACKET - 100) == 0);
+	assert(conn_queue(&conn, huge, 101) == -1 && errno == EMSGSIZE);
+	assert(conn_queue(&conn, huge, 100) == 0);
+	free(huge);
+
+	conn_release(&conn);
+	close(conn.fd);
+	close(peer);
+	free(frame);
+	conn_pool_drain();
+	assert(conn_pool_idle() == 0);
+	printf("✓ Lazy buffer tests passed\n\n");
+}
+
+void test_connect_info(void)
+{
+	printf("Testing stored CONNECT fields...\n");
+
+	struct connection conn;
+	conn_init(&conn, -1);
+
+	// Lengths are taken as given, embedded NULs included
+	const unsigned char cid[] = { 'd', 0, 'v' };
+	const unsigned char msg[] = { 0, 1, 0 };
+	struct conn_params params = {
+		.client_id = cid,
+		.client_id_len = sizeof(cid),
+		.username = (const unsigned char *)"user",
+		.username_len = 4,
+		.will_topic = (const unsigned char *)"dev/status",
+		.will_topic_len = 10,
+		.will_message = msg,
+		.will_message_len = sizeof(msg),
+		.keepalive = 60,
+		.clean_session = 1,
+		.will_qos = 1,
+		.will_retain = 0,
+	};
+	assert(conn_set_info(&conn, &params) == 0);
+	assert(conn.state == CONN_CONNECTED);
+	assert(conn.keepalive == 60);
+	assert(conn.clean_session == 1);
+
+	size_t len;
+	const unsigned char *bytes = conn_client_id(&conn, &len);
+	assert(len == sizeof(cid) && memcmp(bytes, cid, len) == 0);
+	bytes = conn_username(&conn, &len);
+	assert(len == 4 && memcmp(bytes, "user", 4) == 0);
+	const struct conn_info *info = conn.info;
+	assert(info->will_qos == 1);
+	assert(info->will_retain == 0);
+	assert(info->will_topic_len == 10 && info->will_message_len == 3);
+	bytes = info->data + info->client_id_len + info->username_len;
+	assert(memcmp(bytes, "dev/status", 10) == 0);
+	assert(memcmp(bytes + 10, msg, sizeof(msg)) == 0);
+
+	// Without a will its QoS and retain flag are ignored
+	params.will_topic = NULL;
+	params.will_qos = 2;
+	params.will_retain = 1;
+	params.clean_session = 0;
+	params.keepalive = 30;
+	assert(conn_set_info(&conn, &params) == 0);
+	assert(conn.clean_session == 0);
+	assert(conn.keepalive == 30);
+	assert(conn.info->will_topic_len == 0);
+	assert(conn.info->will_qos == 0 && conn.info->will_retain == 0);
+
+	// Malformed wills are refused and leave the stored fields alone
+	params.will_topic = (const unsigned char *)"dev/status";
+	params.will_qos = 3;
+	assert(conn_set_info(&conn, &params) == -1);
+	params.will_qos = 2;
+	params.will_topic_len = 0;
+	assert(conn_set_info(&conn, &params) == -1);
+	assert(conn.keepalive == 30 && conn.info->will_topic_len == 0);
+
+	conn_release(&conn);
+	printf("✓ CONNECT field tests passed\n\n");
+}
+
+void test_idle_footprint(void)
+{
+	printf("Testing idle connection footprint...\n");
+
+	assert(sizeof(struct connection) <= 64);
+
+	// Two descriptors per connection
+	struct rlimit rl;
+	assert(getrlimit(RLIMIT_NOFILE, &rl) == 0);
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rl);
+	getrlimit(RLIMIT_NOFILE, &rl);
+	long n = rl.rlim_cur == RLIM_INFINITY ? MAX_CONNECTIONS :
+						 ((long)rl.rlim_cur - 64) / 2;
+	if (n > MAX_CONNECTIONS)
+		n = MAX_CONNECTIONS;
+	assert(n >= 100);
+
+	int *peers = malloc(n * sizeof(*peers));
+	long before = resident_bytes();
+	struct connection *conns = calloc(n, sizeof(*conns));
+
+	const unsigned char connack[] = { CONNACK_BYTE, 2, 0, 0 };
+	unsigned char request[64], reply[sizeof(connack)];
+	memset(request, 0x10, sizeof(request));
+	for (long i = 0; i < n; i++) {
+		open_pair(&conns[i], &peers[i]);
+
+		// CONNECT arrives, is decoded and answered, then the client idles
+		assert(send_bytes(peers[i], request, sizeof(request)) ==
+		       sizeof(request));
+		assert(conn_recv(&conns[i]) == sizeof(request));
+		size_t len;
+		conn_pending(&conns[i], &len);
+		conn_consume(&conns[i], len);
+
+		char client_id[32];
+		snprintf(client_id, sizeof(client_id), "sensor-%06ld", i);
+		struct conn_params params = {
+			.client_id = (unsigned char *)client_id,
+			.client_id_len = strlen(client_id),
+			.keepalive = 60,
+		};
+		assert(conn_set_info(&conns[i], &params) == 0);
+
+		assert(conn_queue(&conns[i], connack, sizeof(connack)) == 0);
+		assert(conn_flush(&conns[i]) == 0);
+		assert(recv_bytes(peers[i], reply, sizeof(reply)) ==
+		       sizeof(reply));
+		assert(conns[i].rbuf == NULL && conns[i].wbuf == NULL);
+	}
+	long after = resident_bytes();
+
+	// The same buffer served every connection
+	assert(conn_pool_idle() == 1);
+	size_t len;
+	const unsigned char *cid = conn_client_id(&conns[n - 1], &len);
+	assert(len == 13 && memcmp(cid, "sensor-", 7) == 0);
+	assert(conn_username(&conns[n - 1], &len) == NULL);
+
+	long per_conn = (after - before) / n;
+	printf("  %ld connections, %zu byte hot state, %ld bytes RSS each "
+	       "(kernel socket memory excluded)\n",
+	       n, sizeof(struct connection), per_conn);
+	assert(per_conn < IDLE_BUDGET);
+
+	for (long i = 0; i < n; i++) {
+		conn_release(&conns[i]);
+		close(conns[i].fd);
+		close(peers[i]);
+	}
+	free(conns);
+	free(peers);
+	conn_pool_drain();
+	printf("✓ Idle footprint tests passed\n\n");
+}
+
+int main(void)
+{
+	printf("Running connection module unit tests\n");
+	printf("===================================\n\n");
+
+	test_buffers();
+	test_connect_info();
+	test_idle_footprint();
+
+	printf("All tests passed!\n");
+	return 0;
+}
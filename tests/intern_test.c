@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "../include/intern.h"
+
+#define THREADS 4
+#define TOPICS 64
+#define ROUNDS 2000
+
+static uint32_t acquire(struct intern_table *table, const char *topic)
+{
+	return intern_acquire(table, (const unsigned char *)topic,
+			      strlen(topic));
+}
+
+void test_intern_ids(void)
+{
+	printf("Testing intern_acquire and intern_release...\n");
+
+	struct intern_table table;
+	assert(intern_init(&table) == 0);
+
+	uint32_t a = acquire(&table, "sensors/1/temp");
+	uint32_t b = acquire(&table, "sensors/2/temp");
+	uint32_t a2 = acquire(&table, "sensors/1/temp");
+	printf("  ids: %u %u %u\n", a, b, a2);
+	assert(a != INTERN_INVALID_ID && b != INTERN_INVALID_ID);
+	assert(a != b);
+	assert(a == a2);
+
+	// Levels are split once at intern time
+	const struct topic_entry *e = intern_lookup(&table, a);
+	assert(e && e->nlevels == 3);
+	unsigned short len;
+	const unsigned char *level = intern_level(e, 1, &len);
+	assert(len == 1 && level[0] == '1');
+	level = intern_level(e, 2, &len);
+	assert(len == 4 && memcmp(level, "temp", 4) == 0);
+
+	// Empty levels are kept
+	uint32_t c = acquire(&table, "/a/");
+	e = intern_lookup(&table, c);
+	assert(e->nlevels == 3);
+	intern_level(e, 0, &len);
+	assert(len == 0);
+	intern_level(e, 2, &len);
+	assert(len == 0);
+	intern_release(&table, c);
+
+	// Evicted only once the last reference is gone
+	intern_release(&table, a);
+	assert(intern_lookup(&table, a) != NULL);
+	intern_release(&table, a);
+	assert(intern_lookup(&table, a) == NULL);
+	assert(table.count == 1);
+
+	// Released IDs are recycled
+	uint32_t d = acquire(&table, "cameras/front");
+	assert(d == a || d == c);
+
+	intern_destroy(&table);
+	printf("✓ intern_acquire and intern_release tests passed\n\n");
+}
+
+static struct intern_table shared;
+
+static void *churn(void *arg)
+{
+	(void)arg;
+	char topic[32];
+	for (int r = 0; r < ROUNDS; r++) {
+		snprintf(topic, sizeof(topic), "devices/%d/state", r % TOPICS);
+		uint32_t id = acquire(&shared, topic);
+		assert(id != INTERN_INVALID_ID);
+		const struct topic_entry *e = intern_lookup(&shared, id);
+		assert(e && strcmp((const char *)e->topic, topic) == 0);
+		intern_release(&shared, id);
+	}
+	return NULL;
+}
+
+void test_intern_concurrent(void)
+{
+	printf("Testing intern table under concurrent churn...\n");
+
+	assert(intern_init(&shared) == 0);
+
+	pthread_t threads[THREADS];
+	for (int i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, churn, NULL);
+	for (int i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	printf("  %zu topics left interned\n", shared.count);
+	assert(shared.count == 0);
+
+	intern_destroy(&shared);
+	printf("✓ intern table concurrency tests passed\n\n");
+}
+
+int main(void)
+{
+	printf("Running intern module unit tests\n");
+	printf("===============================\n\n");
+
+	test_intern_ids();
+	test_intern_concurrent();
+
+	printf("All tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../include/mqtt.h"
+#include "../include/network.h"
+
+void test_unix_socket(void)
+{
+	printf("Testing Unix domain socket listener...\n");
+
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/cmqtt_test_%d.sock", (int)getpid());
+
+	int lfd = make_unix_listen(path);
+	assert(lfd != -1);
+	assert(socket_port(lfd) == -1);
+
+	// A live listener is never unlinked from under its clients
+	errno = 0;
+	assert(make_unix_listen(path) == -1);
+	assert(errno == EADDRINUSE);
+	int cfd = make_unix_connection(path);
+	assert(cfd != -1);
+	close(cfd);
+
+	// A socket file left behind by a previous run does not block binding
+	close(lfd);
+	lfd = make_unix_listen(path);
+	assert(lfd != -1);
+
+	cfd = make_unix_connection(path);
+	assert(cfd != -1);
+	int sfd = accept(lfd, NULL, NULL);
+	assert(sfd != -1);
+
+	// Accepted Unix domain sockets are sized on their own
+	int def, size;
+	socklen_t optlen = sizeof(int);
+	assert(getsockopt(sfd, SOL_SOCKET, SO_SNDBUF, &def, &optlen) == 0);
+	assert(set_socket_buffers(sfd, 8192) == 0);
+	assert(getsockopt(sfd, SOL_SOCKET, SO_SNDBUF, &size, &optlen) == 0);
+	assert(size < def);
+
+	// Same framing as over TCP
+	const unsigned char frame[] = { PUBLISH_BYTE, 5, 0, 1, 'a', 'h', 'i' };
+	assert(send_bytes(cfd, frame, sizeof(frame)) == sizeof(frame));
+	unsigned char buf[sizeof(frame)];
+	assert(recv_bytes(sfd, buf, sizeof(buf)) == sizeof(buf));
+	assert(memcmp(buf, frame, sizeof(frame)) == 0);
+	const unsigned char *ptr = buf + 1;
+	assert(mqtt_decode_length(&ptr) == 5);
+
+	close(cfd);
+	assert(recv_bytes(sfd, buf, 1) == 0);
+	close(sfd);
+	close(lfd);
+
+	// Regular files are never removed
+	unlink(path);
+	int fd = open(path, O_CREAT | O_WRONLY, 0600);
+	assert(fd != -1);
+	close(fd);
+	assert(make_unix_listen(path) == -1);
+	unlink(path);
+
+	printf("✓ Unix domain socket tests passed\n\n");
+}
+
+int main(void)
+{
+	printf("Running network module unit tests\n");
+	printf("================================\n\n");
+
+	test_unix_socket();
+
+	printf("All tests passed!\n");
+	return 0;
+}
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include "../include/mqtt.h"
 #include "../include/pack.h"
 
 void test_pack_unpack_u8(void)
@@ -68,8 +69,8 @@ void test_pack_unpack_u16(void)
 	}
 
 	// Verify buffer pointer position
-	assert(buf_ptr - buffer == num_values * sizeof(uint16_t));
-	assert(unpack_ptr - buffer == num_values * sizeof(uint16_t));
+	assert((size_t)(buf_ptr - buffer) == num_values * sizeof(uint16_t));
+	assert((size_t)(unpack_ptr - buffer) == num_values * sizeof(uint16_t));
 
 	printf("✓ pack_u16 and unpack_u16 tests passed\n\n");
 }
@@ -104,8 +105,8 @@ void test_pack_unpack_u32(void)
 	}
 
 	// Verify buffer pointer position
-	assert(buf_ptr - buffer == num_values * sizeof(uint32_t));
-	assert(unpack_ptr - buffer == num_values * sizeof(uint32_t));
+	assert((size_t)(buf_ptr - buffer) == num_values * sizeof(uint32_t));
+	assert((size_t)(unpack_ptr - buffer) == num_values * sizeof(uint32_t));
 
 	printf("✓ pack_u32 and unpack_u32 tests passed\n\n");
 }
@@ -146,8 +147,8 @@ void test_pack_unpack_bytes(void)
 		assert(strcmp((char *)result, test_strings[i]) == 0);
 
 		// Verify pointer positions
-		assert(buf_ptr - buffer == strlen(test_strings[i]));
-		assert(unpack_ptr - buffer == strlen(test_strings[i]));
+		assert((size_t)(buf_ptr - buffer) == strlen(test_strings[i]));
+		assert((size_t)(unpack_ptr - buffer) == strlen(test_strings[i]));
 
 		// Clean up
 		free(buffer);
@@ -196,7 +197,7 @@ void test_unpack_string16(void)
 		assert(strcmp((char *)result, test_strings[i]) == 0);
 
 		// Verify buffer pointer position
-		assert(unpack_ptr - buffer == buffer_size);
+		assert((size_t)(unpack_ptr - buffer) == buffer_size);
 
 		// Clean up
 		free(buffer);
@@ -250,11 +251,53 @@ void test_combined_operations(void)
 	assert(strcmp((char *)unpacked_str, (char *)str) == 0);
 
 	// Verify final pointer position
-	assert(unpack_ptr - buffer == used_size);
+	assert((size_t)(unpack_ptr - buffer) == used_size);
 
 	printf("✓ Combined operations test passed\n\n");
 }
 
+void test_pack_string16(void)
+{
+	printf("Testing pack_string16 and pack_nbytes...\n");
+
+	// Binary payload with an embedded NUL byte
+	const uint8_t payload[] = { 'a', 0x00, 'b', 0xff };
+	const char *topic = "sensors/1/temp";
+	uint16_t topic_len = strlen(topic);
+
+	uint8_t buffer[64] = { 0 };
+	uint8_t *buf_ptr = buffer;
+
+	pack_string16(&buf_ptr, (const uint8_t *)topic, topic_len);
+	pack_nbytes(&buf_ptr, payload, sizeof(payload));
+
+	assert(buf_ptr - buffer ==
+	       (long)(sizeof(uint16_t) + topic_len + sizeof(payload)));
+
+	// Unpack and verify
+	uint8_t *unpack_ptr = buffer;
+	uint8_t *result = NULL;
+	uint16_t len = unpack_string16(&unpack_ptr, &result);
+
+	printf("  string: packed \"%s\", unpacked \"%s\"\n", topic, result);
+	assert(len == topic_len);
+	assert(strcmp((char *)result, topic) == 0);
+	assert(memcmp(unpack_ptr, payload, sizeof(payload)) == 0);
+
+	free(result);
+
+	// The view variant points into the buffer instead of copying
+	const uint8_t *view_ptr = buffer;
+	const uint8_t *view = NULL;
+	len = unpack_string16_view(&view_ptr, &view);
+	assert(len == topic_len);
+	assert(view == buffer + sizeof(uint16_t));
+	assert(memcmp(view, topic, topic_len) == 0);
+	assert(view_ptr == unpack_ptr);
+
+	printf("✓ pack_string16 and pack_nbytes tests passed\n\n");
+}
+
 void test_error_cases(void)
 {
 	printf("Testing error handling and edge cases...\n");
@@ -278,6 +321,46 @@ void test_error_cases(void)
 	printf("✓ Error handling tests passed\n\n");
 }
 
+static size_t encode_publish(unsigned char *buf, const char *topic,
+			     size_t payload)
+{
+	uint8_t *ptr = buf;
+	uint16_t topiclen = strlen(topic);
+	pack_u8(&ptr, PUBLISH_BYTE);
+	ptr += mqtt_encode_length(ptr, sizeof(uint16_t) + topiclen + payload);
+	pack_string16(&ptr, (const unsigned char *)topic, topiclen);
+	memset(ptr, 'x', payload);
+	return ptr + payload - buf;
+}
+
+void test_peek_publish(void)
+{
+	printf("Testing mqtt_peek_publish...\n");
+
+	unsigned char frame[512];
+	size_t len = encode_publish(frame, "plant/7/temp", 300);
+	const unsigned char *topic;
+	unsigned short topiclen;
+
+	assert(mqtt_peek_publish(frame, len, &topic, &topiclen) == (long)len);
+	assert(topiclen == 12 && memcmp(topic, "plant/7/temp", 12) == 0);
+
+	// Partial frames ask for more bytes, the payload is not needed
+	assert(mqtt_peek_publish(frame, 2, &topic, &topiclen) == 0);
+	assert(mqtt_peek_publish(frame, 10, &topic, &topiclen) == 0);
+	assert(mqtt_peek_publish(frame, 17, &topic, &topiclen) == (long)len);
+
+	// Not a PUBLISH, or a topic longer than the frame
+	frame[0] = CONNACK_BYTE;
+	assert(mqtt_peek_publish(frame, len, &topic, &topiclen) == -1);
+	const unsigned char bad[] = { PUBLISH_BYTE, 4, 0, 9, 'a', 'b' };
+	assert(mqtt_peek_publish(bad, sizeof(bad), &topic, &topiclen) == -1);
+	const unsigned char huge[] = { PUBLISH_BYTE, 0xff, 0xff, 0xff, 0xff, 1 };
+	assert(mqtt_peek_publish(huge, sizeof(huge), &topic, &topiclen) == -1);
+
+	printf("✓ mqtt_peek_publish tests passed\n\n");
+}
+
 int main(void)
 {
 	printf("Running pack module unit tests\n");
@@ -289,7 +372,9 @@ int main(void)
 	test_pack_unpack_bytes();
 	test_unpack_string16();
 	test_combined_operations();
+	test_pack_string16();
 	test_error_cases();
+	test_peek_publish();
 
 	printf("All tests passed!\n");
 	return 0;
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "../include/pktid.h"
+
+void test_pktid_inline(void)
+{
+	printf("Testing pktid_set in inline mode...\n");
+
+	struct pktid_set set;
+	pktid_set_init(&set);
+	printf("  sizeof(struct pktid_set) = %zu\n", sizeof(set));
+	assert(sizeof(set) <= 16);
+
+	for (uint16_t id = 1; id <= PKTID_INLINE; id++)
+		assert(pktid_set_add(&set, id) == 1);
+	assert(set.mode == PKTID_MODE_INLINE);
+
+	// PUBLISH retransmitted before PUBREL is a duplicate
+	assert(pktid_set_add(&set, 2) == 0);
+	assert(pktid_set_contains(&set, 2));
+	assert(pktid_set_remove(&set, 2) == 1);
+	assert(pktid_set_remove(&set, 2) == 0);
+	assert(!pktid_set_contains(&set, 2));
+	assert(set.count == PKTID_INLINE - 1);
+
+	pktid_set_release(&set);
+	printf("✓ pktid_set inline tests passed\n\n");
+}
+
+void test_pktid_sorted(void)
+{
+	printf("Testing pktid_set in sorted mode...\n");
+
+	struct pktid_set set;
+	pktid_set_init(&set);
+
+	// Descending and interleaved IDs exercise every insertion position
+	for (uint32_t i = 0; i < PKTID_SORTED_MAX; i++) {
+		uint16_t id = (i % 2 ? 1000 + i : 1000 - i);
+		assert(pktid_set_add(&set, id) == 1);
+		assert(pktid_set_add(&set, id) == 0);
+	}
+	assert(set.mode == PKTID_MODE_SORTED);
+	assert(set.count == PKTID_SORTED_MAX);
+	for (uint32_t i = 1; i < set.count; i++)
+		assert(set.sorted[i - 1] < set.sorted[i]);
+	assert(!pktid_set_contains(&set, 1002));
+	assert(pktid_set_contains(&set, 1003));
+
+	// A duplicate of a full array does not switch to the bitmap
+	assert(pktid_set_add(&set, 1000) == 0);
+	assert(set.mode == PKTID_MODE_SORTED);
+
+	// Stays sorted down to the inline size
+	for (uint32_t i = 0; i < PKTID_SORTED_MAX - PKTID_INLINE; i++) {
+		uint16_t id = (i % 2 ? 1000 + i : 1000 - i);
+		assert(pktid_set_remove(&set, id) == 1);
+		assert(pktid_set_remove(&set, id) == 0);
+	}
+	assert(set.mode == PKTID_MODE_SORTED);
+	assert(set.count == PKTID_INLINE);
+
+	// Hovering around the inline size keeps the array
+	for (int round = 0; round < 10; round++) {
+		assert(pktid_set_add(&set, 7) == 1);
+		assert(pktid_set_remove(&set, 7) == 1);
+		assert(set.mode == PKTID_MODE_SORTED);
+	}
+
+	// Shrinks back inline well below, keeping the remaining IDs
+	for (uint32_t i = PKTID_SORTED_MAX - PKTID_INLINE;
+	     i < PKTID_SORTED_MAX - PKTID_SHRINK_INLINE; i++)
+		assert(pktid_set_remove(&set, i % 2 ? 1000 + i : 1000 - i) == 1);
+	assert(set.mode == PKTID_MODE_INLINE);
+	assert(set.count == PKTID_SHRINK_INLINE);
+	for (uint32_t i = PKTID_SORTED_MAX - PKTID_SHRINK_INLINE;
+	     i < PKTID_SORTED_MAX; i++)
+		assert(pktid_set_contains(&set, i % 2 ? 1000 + i : 1000 - i));
+
+	pktid_set_release(&set);
+	printf("✓ pktid_set sorted tests passed\n\n");
+}
+
+void test_pktid_bitmap(void)
+{
+	printf("Testing pktid_set in bitmap mode...\n");
+
+	struct pktid_set set;
+	pktid_set_init(&set);
+
+	for (uint32_t id = 1; id <= 65535; id++)
+		assert(pktid_set_add(&set, id) == 1);
+	assert(set.mode == PKTID_MODE_BITMAP);
+	assert(set.count == 65535);
+
+	for (uint32_t id = 1; id <= 65535; id++) {
+		assert(pktid_set_add(&set, id) == 0);
+		assert(pktid_set_contains(&set, id));
+	}
+	assert(!pktid_set_contains(&set, 0));
+
+	// Still a bitmap at the size it grew at
+	for (uint32_t id = 1; id <= 65535 - PKTID_SORTED_MAX; id++)
+		assert(pktid_set_remove(&set, id) == 1);
+	assert(set.mode == PKTID_MODE_BITMAP);
+
+	// Half that gives the bitmap back for a sorted array
+	for (uint32_t id = 65535 - PKTID_SORTED_MAX + 1;
+	     id <= 65535 - PKTID_SHRINK_SORTED; id++)
+		assert(pktid_set_remove(&set, id) == 1);
+	assert(set.mode == PKTID_MODE_SORTED);
+	assert(set.count == PKTID_SHRINK_SORTED);
+	for (uint32_t i = 1; i < set.count; i++)
+		assert(set.sorted[i - 1] < set.sorted[i]);
+	for (uint32_t id = 65535 - PKTID_SHRINK_SORTED + 1; id <= 65535; id++)
+		assert(pktid_set_contains(&set, id));
+	assert(!pktid_set_contains(&set, 7));
+
+	// Which still grows and shrinks like any sorted array
+	for (uint32_t id = 1; id <= PKTID_SORTED_MAX - PKTID_SHRINK_SORTED;
+	     id++)
+		assert(pktid_set_add(&set, id) == 1);
+	assert(set.mode == PKTID_MODE_SORTED);
+	for (uint32_t id = 1; id <= PKTID_SORTED_MAX - PKTID_SHRINK_SORTED;
+	     id++)
+		assert(pktid_set_remove(&set, id) == 1);
+	for (uint32_t id = 65535 - PKTID_SHRINK_SORTED + 1;
+	     id <= 65535 - PKTID_SHRINK_INLINE; id++)
+		assert(pktid_set_remove(&set, id) == 1);
+	assert(set.mode == PKTID_MODE_INLINE);
+	assert(set.count == PKTID_SHRINK_INLINE);
+
+	pktid_set_release(&set);
+	printf("✓ pktid_set bitmap tests passed\n\n");
+}
+
+int main(void)
+{
+	printf("Running pktid module unit tests\n");
+	printf("==============================\n\n");
+
+	test_pktid_inline();
+	test_pktid_sorted();
+	test_pktid_bitmap();
+
+	printf("All tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,287 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "../include/connection.h"
+#include "../include/mqtt.h"
+#include "../include/network.h"
+#include "../include/pack.h"
+#include "../include/ratelimit.h"
+#include "../include/util.h"
+
+#define MS 1000000ULL
+
+static const unsigned char *bytes(const char *s)
+{
+	return (const unsigned char *)s;
+}
+
+static uint64_t publish(struct ratelimit *rl, struct ratelimit_client *client,
+			const char *topic, size_t size, uint64_t now)
+{
+	return ratelimit_publish(rl, client, bytes(topic), strlen(topic), size,
+				 now);
+}
+
+static size_t encode_publish(unsigned char *buf, const char *topic,
+			     size_t payload)
+{
+	uint8_t *ptr = buf;
+	uint16_t topiclen = strlen(topic);
+	pack_u8(&ptr, PUBLISH_BYTE);
+	ptr += mqtt_encode_length(ptr, sizeof(uint16_t) + topiclen + payload);
+	pack_string16(&ptr, bytes(topic), topiclen);
+	memset(ptr, 'x', payload);
+	return ptr + payload - buf;
+}
+
+void test_client_limits(void)
+{
+	printf("Testing per-client limits...\n");
+
+	struct ratelimit rl;
+	assert(ratelimit_init(&rl) == 0);
+	struct rate_limit defaults = { .msgs_per_sec = 10, .msg_burst = 5 };
+	struct rate_limit gateway = { .msgs_per_sec = 1000, .msg_burst = 100,
+				      .bytes_per_sec = 1000,
+				      .byte_burst = 2000 };
+	assert(ratelimit_add(&rl, RATELIMIT_CLIENT, NULL, 0, defaults) == 0);
+	assert(ratelimit_add(&rl, RATELIMIT_CLIENT, bytes("gw-1"), 4,
+			     gateway) == 0);
+	// Topic rules need a prefix
+	assert(ratelimit_add(&rl, RATELIMIT_TOPIC, NULL, 0, defaults) == -1);
+
+	struct ratelimit_client sensor, gw;
+	assert(ratelimit_attach(&rl, &sensor, bytes("sensor-1"), 8, NULL,
+				0) == 0);
+	assert(ratelimit_attach(&rl, &gw, bytes("gw-1"), 4, NULL, 0) == 0);
+
+	// The burst passes, then every PUBLISH waits 1/rate more
+	uint64_t now = 1000 * MS;
+	for (int i = 0; i < 5; i++)
+		assert(publish(&rl, &sensor, "a", 10, now) == 0);
+	assert(publish(&rl, &sensor, "a", 10, now) == 100 * MS);
+	assert(publish(&rl, &sensor, "a", 10, now) == 200 * MS);
+
+	// Tokens come back with time, 300ms repay the 200ms of debt and one more
+	now += 300 * MS;
+	assert(publish(&rl, &sensor, "a", 10, now) == 0);
+	assert(publish(&rl, &sensor, "a", 10, now) == 100 * MS);
+
+	// The byte limit paces large payloads of an exact client rule
+	assert(publish(&rl, &gw, "a", 1500, now) == 0);
+	assert(publish(&rl, &gw, "a", 1500, now) == 1000 * MS);
+
+	ratelimit_detach(&rl, &sensor);
+	ratelimit_detach(&rl, &gw);
+	ratelimit_destroy(&rl);
+	printf("✓ Per-client limit tests passed\n\n");
+}
+
+void test_shared_limits(void)
+{
+	printf("Testing username and topic prefix limits...\n");
+
+	struct ratelimit rl;
+	assert(ratelimit_init(&rl) == 0);
+	struct rate_limit user = { .msgs_per_sec = 100, .msg_burst = 4 };
+	struct rate_limit flood = { .msgs_per_sec = 10, .msg_burst = 2 };
+	struct rate_limit firmware = { .msgs_per_sec = 1, .msg_burst = 1 };
+	assert(ratelimit_add(&rl, RATELIMIT_USERNAME, NULL, 0, user) == 0);
+	assert(ratelimit_add(&rl, RATELIMIT_TOPIC, bytes("fleet/"), 6,
+			     flood) == 0);
+	assert(ratelimit_add(&rl, RATELIMIT_TOPIC, bytes("fleet/ota/"), 10,
+			     firmware) == 0);
+
+	// Two connections of one username share its bucket
+	struct ratelimit_client a, b, other;
+	assert(ratelimit_attach(&rl, &a, bytes("a"), 1, bytes("acme"), 4) == 0);
+	assert(ratelimit_attach(&rl, &b, bytes("b"), 1, bytes("acme"), 4) == 0);
+	assert(ratelimit_attach(&rl, &other, bytes("c"), 1, bytes("other"),
+				5) == 0);
+	assert(a.user == b.user && a.user != other.user);
+	assert(a.limit == NULL);
+
+	// Connections point at the rules, which are fixed from now on
+	assert(ratelimit_add(&rl, RATELIMIT_TOPIC, bytes("late/"), 5,
+			     flood) == -1 && errno == EBUSY);
+
+	uint64_t now = 1000 * MS;
+	assert(publish(&rl, &a, "misc", 1, now) == 0);
+	assert(publish(&rl, &b, "misc", 1, now) == 0);
+	assert(publish(&rl, &a, "misc", 1, now) == 0);
+	assert(publish(&rl, &b, "misc", 1, now) == 0);
+	assert(publish(&rl, &a, "misc", 1, now) == 10 * MS);
+	assert(publish(&rl, &other, "misc", 1, now) == 0);
+
+	// The longest prefix applies, unrelated topics are not affected
+	struct ratelimit_client anon;
+	assert(ratelimit_attach(&rl, &anon, bytes("d"), 1, NULL, 0) == 0);
+	assert(anon.user == NULL);
+	assert(publish(&rl, &anon, "fleet/ota/v2", 1, now) == 0);
+	assert(publish(&rl, &anon, "fleet/ota/v2", 1, now) == 1000 * MS);
+	assert(publish(&rl, &anon, "fleet/telemetry", 1, now) == 0);
+	assert(publish(&rl, &anon, "fleet/telemetry", 1, now) == 0);
+	assert(publish(&rl, &anon, "fleet/telemetry", 1, now) == 100 * MS);
+	assert(publish(&rl, &anon, "fleetwide", 1, now) == 0);
+
+	// The username bucket goes away with its last connection
+	ratelimit_detach(&rl, &a);
+	ratelimit_detach(&rl, &b);
+	assert(ratelimit_attach(&rl, &a, bytes("a"), 1, bytes("acme"), 4) == 0);
+	assert(a.user->refcount == 1);
+	ratelimit_detach(&rl, &a);
+	ratelimit_detach(&rl, &other);
+
+	ratelimit_destroy(&rl);
+	printf("✓ Shared limit tests passed\n\n");
+}
+
+#define PUBLISHERS 4
+#define PUBLISHES 10000
+
+struct publisher {
+	struct ratelimit *rl;
+	struct ratelimit_client client;
+};
+
+static void *publisher_thread(void *arg)
+{
+	struct publisher *p = arg;
+	for (int i = 0; i < PUBLISHES; i++)
+		publish(p->rl, &p->client, "fleet/telemetry", 1, 1000 * MS);
+	return NULL;
+}
+
+void test_concurrent_publish(void)
+{
+	printf("Testing concurrent publishers of a shared prefix...\n");
+
+	struct ratelimit rl;
+	assert(ratelimit_init(&rl) == 0);
+	struct rate_limit flood = { .msgs_per_sec = 1000, .msg_burst = 1 };
+	struct rate_limit other = { .msgs_per_sec = 1, .msg_burst = 1 };
+	assert(ratelimit_add(&rl, RATELIMIT_TOPIC, bytes("fleet/"), 6,
+			     flood) == 0);
+	// Prefixes of other lengths are probed on the way
+	assert(ratelimit_add(&rl, RATELIMIT_TOPIC, bytes("f"), 1, other) == 0);
+	assert(ratelimit_add(&rl, RATELIMIT_TOPIC, bytes("fleet/ota/v1/"), 13,
+			     other) == 0);
+
+	struct publisher pubs[PUBLISHERS];
+	pthread_t threads[PUBLISHERS];
+	for (int i = 0; i < PUBLISHERS; i++) {
+		pubs[i].rl = &rl;
+		assert(ratelimit_attach(&rl, &pubs[i].client, bytes("p"), 1,
+					NULL, 0) == 0);
+		assert(pthread_create(&threads[i], NULL, publisher_thread,
+				      &pubs[i]) == 0);
+	}
+	for (int i = 0; i < PUBLISHERS; i++)
+		pthread_join(threads[i], NULL);
+
+	// Every charge landed, the next PUBLISH waits for all of them
+	assert(publish(&rl, &pubs[0].client, "fleet/telemetry", 1, 1000 * MS) ==
+	       PUBLISHERS * PUBLISHES * MS);
+
+	for (int i = 0; i < PUBLISHERS; i++)
+		ratelimit_detach(&rl, &pubs[i].client);
+	ratelimit_destroy(&rl);
+	printf("✓ Concurrent publisher tests passed\n\n");
+}
+
+void test_backpressure(void)
+{
+	printf("Testing read pause backpressure...\n");
+
+	struct ratelimit rl;
+	assert(ratelimit_init(&rl) == 0);
+	struct rate_limit limit = { .msgs_per_sec = 20, .msg_burst = 1 };
+	assert(ratelimit_add(&rl, RATELIMIT_CLIENT, NULL, 0, limit) == 0);
+
+	int fds[2];
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	assert(set_nonblocking(fds[0]) == 0);
+	struct connection conn;
+	conn_init(&conn, fds[0]);
+	struct ratelimit_client client;
+	assert(ratelimit_attach(&rl, &client, bytes("dev"), 3, NULL, 0) == 0);
+
+	unsigned char frame[64];
+	size_t len = encode_publish(frame, "dev/1", 8);
+	for (int i = 0; i < 3; i++)
+		assert(send_bytes(fds[1], frame, len) == (ssize_t)len);
+
+	// Checked frame by frame right after the header, nothing is lost
+	int handled = 0, paused = 0;
+	uint64_t start = monotonic_ns();
+	while (handled < 3) {
+		if (conn_recv(&conn) == -1) {
+			if (errno == EBUSY) {
+				// Buffered frames wait for the pause as well, the
+				// timeout stands in for the event loop's timer
+				uint64_t until = conn_paused_until(&conn);
+				uint64_t now = monotonic_ms();
+				paused++;
+				struct pollfd pfd = { .fd = -1 };
+				poll(&pfd, 1, until > now ? until - now : 0);
+				continue;
+			}
+			assert(errno == EAGAIN);
+		}
+		size_t avail;
+		const unsigned char *buf;
+		while ((buf = conn_pending(&conn, &avail))) {
+			const unsigned char *topic;
+			unsigned short topiclen;
+			long n = mqtt_peek_publish(buf, avail, &topic, &topiclen);
+			assert(n > 0);
+			conn_pause(&conn, ratelimit_publish(&rl, &client, topic,
+							    topiclen, n,
+							    monotonic_ns()));
+			conn_consume(&conn, n);
+			handled++;
+			if (conn_paused_until(&conn))
+				break;
+		}
+	}
+	uint64_t elapsed = monotonic_ns() - start;
+	printf("  3 frames handled in %llu ms, %d reads held back\n",
+	       (unsigned long long)(elapsed / MS), paused);
+	assert(paused > 0 && elapsed >= 50 * MS);
+
+	// Absurd delays are capped
+	uint64_t now = monotonic_ms();
+	conn_pause(&conn, UINT64_MAX);
+	uint64_t until = conn_paused_until(&conn);
+	// Allow for the clock moving on between the two reads
+	assert(until > now && until <= now + CONN_MAX_PAUSE_MS + 1000);
+	assert(conn_recv(&conn) == -1 && errno == EBUSY);
+
+	ratelimit_detach(&rl, &client);
+	ratelimit_destroy(&rl);
+	conn_release(&conn);
+	close(fds[0]);
+	close(fds[1]);
+	printf("✓ Backpressure tests passed\n\n");
+}
+
+int main(void)
+{
+	printf("Running ratelimit module unit tests\n");
+	printf("==================================\n\n");
+
+	test_client_limits();
+	test_shared_limits();
+	test_concurrent_publish();
+	test_backpressure();
+
+	printf("All tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "../include/topic.h"
+
+static int match(const char *filter, const char *topic)
+{
+	return topic_match((const unsigned char *)filter, strlen(filter),
+			   (const unsigned char *)topic, strlen(topic));
+}
+
+static int covers(const char *a, const char *b)
+{
+	return topic_filter_covers((const unsigned char *)a, strlen(a),
+				   (const unsigned char *)b, strlen(b));
+}
+
+void test_topic_match(void)
+{
+	printf("Testing topic_match...\n");
+
+	struct {
+		const char *filter;
+		const char *topic;
+		int expected;
+	} cases[] = {
+		{ "a/b/c", "a/b/c", 1 },   { "a/b/c", "a/b", 0 },
+		{ "a/b", "a/b/c", 0 },     { "a/+/c", "a/b/c", 1 },
+		{ "a/+/c", "a/b/d", 0 },   { "a/+", "a/", 1 },
+		{ "+/+", "/a", 1 },        { "a/#", "a", 1 },
+		{ "a/#", "a/b/c", 1 },     { "a/#", "b/c", 0 },
+		{ "#", "a/b/c", 1 },       { "+", "a/b", 0 },
+		{ "#", "$SYS/load", 0 },   { "+/load", "$SYS/load", 0 },
+		{ "$SYS/#", "$SYS/load", 1 },
+	};
+	int num_cases = sizeof(cases) / sizeof(cases[0]);
+
+	for (int i = 0; i < num_cases; i++) {
+		int result = match(cases[i].filter, cases[i].topic);
+		printf("  \"%s\" ~ \"%s\": %d\n", cases[i].filter,
+		       cases[i].topic, result);
+		assert(result == cases[i].expected);
+	}
+
+	printf("✓ topic_match tests passed\n\n");
+}
+
+void test_topic_filter_covers(void)
+{
+	printf("Testing topic_filter_covers...\n");
+
+	assert(covers("a/#", "a/b/c"));
+	assert(covers("a/#", "a/+"));
+	assert(covers("a/+", "a/b"));
+	assert(covers("a/b", "a/b"));
+	assert(covers("#", "a/#"));
+	assert(!covers("a/+", "a/#"));
+	assert(!covers("a/b", "a/+"));
+	assert(!covers("a/+", "a/b/c"));
+	assert(!covers("+/#", "$SYS/#"));
+
+	printf("✓ topic_filter_covers tests passed\n\n");
+}
+
+int main(void)
+{
+	printf("Running topic module unit tests\n");
+	printf("==============================\n\n");
+
+	test_topic_match();
+	test_topic_filter_covers();
+
+	printf("All tests passed!\n");
+	return 0;
+}
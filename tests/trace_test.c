@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../include/mqtt.h"
+#include "../include/trace.h"
+
+void test_trace_histogram(void)
+{
+	printf("Testing trace_record and trace_percentile...\n");
+
+	// 99 fast samples and one slow outlier
+	for (int i = 0; i < 99; i++)
+		trace_record(TRACE_DECODE, PUBLISH, 100);
+	trace_record(TRACE_DECODE, PUBLISH, 1000000);
+
+	struct trace_histogram h;
+	trace_snapshot(&h, TRACE_DECODE, PUBLISH);
+	printf("  count %llu, p50 %llu, p99 %llu, max %llu\n",
+	       (unsigned long long)h.count,
+	       (unsigned long long)trace_percentile(&h, 50),
+	       (unsigned long long)trace_percentile(&h, 99),
+	       (unsigned long long)h.max_ns);
+
+	assert(h.count == 100);
+	assert(h.max_ns == 1000000);
+	assert(trace_percentile(&h, 50) >= 100);
+	assert(trace_percentile(&h, 50) < 256);
+	// Bucket bounds never report more than the slowest sample
+	assert(trace_percentile(&h, 99) <= h.max_ns);
+	assert(trace_percentile(&h, 100) == h.max_ns);
+
+	// Other stages and types are untouched
+	trace_snapshot(&h, TRACE_DECODE, CONNECT);
+	assert(h.count == 0);
+	trace_snapshot(&h, TRACE_ROUTE, PUBLISH);
+	assert(h.count == 0);
+
+	uint64_t t0 = trace_now();
+	assert(trace_now() >= t0);
+
+	trace_dump(stdout);
+	printf("✓ trace histogram tests passed\n\n");
+}
+
+#define EXPAND(...) #__VA_ARGS__
+#define STRINGIFY(...) EXPAND(__VA_ARGS__)
+
+void test_trace_points(void)
+{
+	printf("Testing tracepoints on the decode path...\n");
+
+	const unsigned char frame[] = { PUBLISH_BYTE, 5, 0, 3, 'a', '/', 'b' };
+	const unsigned char *topic;
+	unsigned short topiclen;
+	struct trace_histogram before, after;
+
+	trace_snapshot(&before, TRACE_DECODE, PUBLISH);
+	assert(mqtt_peek_publish(frame, sizeof(frame), &topic, &topiclen) ==
+	       (long)sizeof(frame));
+	trace_snapshot(&after, TRACE_DECODE, PUBLISH);
+
+#ifdef CMQTT_TRACE
+	assert(after.count == before.count + 1);
+#else
+	// Compiled out, the macros leave no code behind
+	assert(strcmp(STRINGIFY(TRACE_BEGIN(start)), "") == 0);
+	assert(strcmp(STRINGIFY(TRACE_END(start, TRACE_DECODE, PUBLISH)),
+		      "") == 0);
+	assert(after.count == before.count);
+#endif
+
+	printf("✓ tracepoint tests passed\n\n");
+}
+
+int main(void)
+{
+	printf("Running trace module unit tests\n");
+	printf("==============================\n\n");
+
+	test_trace_histogram();
+	test_trace_points();
+
+	printf("All tests passed!\n");
+	return 0;
+}
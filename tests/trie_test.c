@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "../include/matchcache.h"
+#include "../include/trie.h"
+
+static void subscribe(struct sub_trie *trie, const char *filter,
+		      unsigned client, unsigned qos)
+{
+	struct subscription sub = { .client = client, .qos = qos };
+	assert(trie_subscribe(trie, (const unsigned char *)filter,
+			      strlen(filter), sub) == 0);
+}
+
+static size_t match(const struct sub_trie *trie, const char *topic,
+		    struct sub_set *out)
+{
+	assert(trie_match(trie, (const unsigned char *)topic, strlen(topic),
+			  out, NULL) == 0);
+	return out->len;
+}
+
+void test_trie_match(void)
+{
+	printf("Testing trie_match...\n");
+
+	struct sub_trie trie;
+	trie_init(&trie);
+	struct sub_set out = { 0 };
+
+	subscribe(&trie, "sensors/1/temp", 1, 0);
+	subscribe(&trie, "sensors/+/temp", 2, 1);
+	subscribe(&trie, "sensors/#", 3, 0);
+	subscribe(&trie, "#", 4, 0);
+	// Client 1 again through a wildcard with a higher QoS
+	subscribe(&trie, "sensors/+/+", 1, 2);
+
+	assert(match(&trie, "sensors/1/temp", &out) == 4);
+	assert(out.subs[0].client == 1 && out.subs[0].qos == 2);
+
+	assert(match(&trie, "sensors/2/temp", &out) == 4);
+	assert(match(&trie, "sensors", &out) == 2);
+	assert(match(&trie, "other/topic", &out) == 1);
+	assert(match(&trie, "$SYS/load", &out) == 0);
+
+	assert(trie_unsubscribe(&trie, (const unsigned char *)"#", 1, 4) == 1);
+	assert(trie_unsubscribe(&trie, (const unsigned char *)"#", 1, 4) == 0);
+	assert(match(&trie, "other/topic", &out) == 0);
+
+	sub_set_release(&out);
+	trie_destroy(&trie);
+	printf("✓ trie_match tests passed\n\n");
+}
+
+void test_trie_prune(void)
+{
+	printf("Testing sorted children and pruning...\n");
+
+	struct sub_trie trie;
+	trie_init(&trie);
+	struct sub_set out = { 0 };
+	char filter[32];
+
+	// Enough siblings to grow and shift the sorted child array
+	for (int i = 99; i >= 0; i--) {
+		snprintf(filter, sizeof(filter), "site/%d/+", i * 7 % 100);
+		subscribe(&trie, filter, i, 0);
+	}
+	subscribe(&trie, "site/#", 100, 0);
+	assert(trie.nodes == 1 + 100 + 100 + 1);
+	assert(match(&trie, "site/42/x", &out) == 2);
+	assert(match(&trie, "site/100/x", &out) == 1);
+
+	// Emptied nodes are freed up to the first one still in use
+	for (int i = 0; i < 100; i++) {
+		snprintf(filter, sizeof(filter), "site/%d/+", i * 7 % 100);
+		assert(trie_unsubscribe(&trie, (const unsigned char *)filter,
+					strlen(filter), i) == 1);
+	}
+	assert(trie.nodes == 2);
+	assert(match(&trie, "site/42/x", &out) == 1);
+	assert(trie_unsubscribe(&trie, (const unsigned char *)"site/#", 6,
+				100) == 1);
+	assert(trie.nodes == 0 && trie.root.nchildren == 0);
+
+	// A node kept alive by another subscriber stays
+	subscribe(&trie, "a/b", 1, 0);
+	subscribe(&trie, "a/b", 2, 0);
+	assert(trie_unsubscribe(&trie, (const unsigned char *)"a/b", 3, 1) == 1);
+	assert(trie.nodes == 2);
+	assert(trie_unsubscribe(&trie, (const unsigned char *)"a/b", 3, 3) == 0);
+	assert(match(&trie, "a/b", &out) == 1);
+
+	sub_set_release(&out);
+	trie_destroy(&trie);
+	printf("✓ Sorted children and pruning tests passed\n\n");
+}
+
+void test_match_cache(void)
+{
+	printf("Testing match cache invalidation...\n");
+
+	struct sub_trie trie;
+	trie_init(&trie);
+	struct intern_table table;
+	assert(intern_init(&table) == 0);
+	struct match_cache cache;
+	assert(match_cache_init(&cache, 100) == 0);
+	assert(cache.cap == 128);
+
+	subscribe(&trie, "sensors/+/temp", 1, 0);
+	subscribe(&trie, "cameras/#", 2, 0);
+
+	const char *hot = "sensors/1/temp";
+	uint32_t id = intern_acquire(&table, (const unsigned char *)hot,
+				     strlen(hot));
+	const struct topic_entry *topic = intern_lookup(&table, id);
+
+	const struct sub_set *subs = match_cache_lookup(&cache, &trie, topic);
+	assert(subs->len == 1 && cache.stats.misses == 1);
+	subs = match_cache_lookup(&cache, &trie, topic);
+	assert(subs->len == 1 && cache.stats.hits == 1);
+
+	// A change outside the walked path keeps the entry
+	subscribe(&trie, "cameras/front", 3, 0);
+	subs = match_cache_lookup(&cache, &trie, topic);
+	assert(cache.stats.hits == 2 && cache.stats.stale == 0);
+
+	// A new matching filter invalidates it
+	subscribe(&trie, "sensors/1/#", 4, 0);
+	subs = match_cache_lookup(&cache, &trie, topic);
+	assert(cache.stats.stale == 1);
+	assert(subs->len == 2);
+
+	// So does removing a subscriber on the walked path
+	trie_unsubscribe(&trie, (const unsigned char *)"sensors/+/temp", 14, 1);
+	subs = match_cache_lookup(&cache, &trie, topic);
+	assert(cache.stats.stale == 2);
+	assert(subs->len == 1 && subs->subs[0].client == 4);
+
+	// New top-level filters only invalidate walks of the same level hash
+	uint64_t stale = cache.stats.stale;
+	char filter[32];
+	for (int i = 0; i < 64; i++) {
+		snprintf(filter, sizeof(filter), "zone%d/temp", i);
+		subscribe(&trie, filter, 5, 0);
+		match_cache_lookup(&cache, &trie, topic);
+	}
+	printf("  64 new top-level levels, %llu invalidations\n",
+	       (unsigned long long)(cache.stats.stale - stale));
+	assert(cache.stats.stale - stale < 32);
+
+	// Pruning the walked nodes invalidates without reading them
+	trie_unsubscribe(&trie, (const unsigned char *)"sensors/1/#", 11, 4);
+	subs = match_cache_lookup(&cache, &trie, topic);
+	assert(subs->len == 0);
+
+	printf("  hits %llu, misses %llu, stale %llu\n",
+	       (unsigned long long)cache.stats.hits,
+	       (unsigned long long)cache.stats.misses,
+	       (unsigned long long)cache.stats.stale);
+
+	intern_release(&table, id);
+	match_cache_destroy(&cache);
+	intern_destroy(&table);
+	trie_destroy(&trie);
+	printf("✓ match cache invalidation tests passed\n\n");
+}
+
+int main(void)
+{
+	printf("Running trie module unit tests\n");
+	printf("=============================\n\n");
+
+	test_trie_match();
+	test_trie_prune();
+	test_match_cache();
+
+	printf("All tests passed!\n");
+	return 0;
+}
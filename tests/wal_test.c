@@ -0,0 +1,273 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../include/pack.h"
+#include "../include/util.h"
+#include "../include/wal.h"
+
+#define THREADS 4
+#define RECORDS_PER_THREAD 500
+
+struct acks {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int count;
+	int error;          /**< Error of the last failed record */
+	const char *path;   /**< Log file to check records against */
+	long on_disk;       /**< Records found in the log so far */
+};
+
+static struct wal wal;
+static struct acks acks = { PTHREAD_MUTEX_INITIALIZER,
+			    PTHREAD_COND_INITIALIZER, 0, 0, NULL, 0 };
+
+// Stands in for queueing the PUBACK back to the connection's thread
+static void on_durable(uint64_t seq, int error, void *arg)
+{
+	struct acks *a = arg;
+	pthread_mutex_lock(&a->lock);
+	if (error) {
+		a->error = error;
+	} else if (a->path) {
+		// Records are logged in sequence order, so seq must be on disk
+		if ((long)seq > a->on_disk)
+			a->on_disk = wal_replay(a->path, NULL, NULL);
+		assert((long)seq <= a->on_disk);
+	}
+	a->count++;
+	pthread_cond_signal(&a->cond);
+	pthread_mutex_unlock(&a->lock);
+}
+
+static void wait_acks(struct acks *a, int count)
+{
+	pthread_mutex_lock(&a->lock);
+	while (a->count < count)
+		pthread_cond_wait(&a->cond, &a->lock);
+	pthread_mutex_unlock(&a->lock);
+}
+
+static void *publisher(void *arg)
+{
+	long id = (long)arg;
+	char topic[32], payload[32];
+
+	for (int i = 0; i < RECORDS_PER_THREAD; i++) {
+		snprintf(topic, sizeof(topic), "devices/%ld", id);
+		snprintf(payload, sizeof(payload), "%d", i);
+		struct mqtt_publish pkt = {
+			.header = { .byte = PUBLISH_BYTE | 0x02 },
+			.pkt_id = i + 1,
+			.topiclen = strlen(topic),
+			.topic = (unsigned char *)topic,
+			.payloadlen = strlen(payload),
+			.payload = (unsigned char *)payload,
+		};
+		assert(wal_append(&wal, &pkt, on_durable, &acks) != 0);
+	}
+	return NULL;
+}
+
+static void count_record(const struct mqtt_publish *pkt, void *arg)
+{
+	int *seen = arg;
+	assert(pkt->header.bits.qos == AT_LEAST_ONCE);
+	assert(pkt->topiclen == strlen("devices/0"));
+	assert(memcmp(pkt->topic, "devices/", 8) == 0);
+	(*seen)++;
+}
+
+void test_group_commit(void)
+{
+	printf("Testing WAL group commit...\n");
+
+	char path[] = "/tmp/cmqtt_wal_XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd != -1);
+	close(fd);
+
+	acks.path = path;
+	assert(wal_open(&wal, path, WAL_DEFAULT_WINDOW_US) == 0);
+
+	pthread_t threads[THREADS];
+	for (long i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, publisher, (void *)i);
+	for (int i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	// on_durable checks that no record is acknowledged before it is synced
+	wait_acks(&acks, THREADS * RECORDS_PER_THREAD);
+	assert(acks.error == 0);
+
+	printf("  %llu records durable in %llu commits\n",
+	       (unsigned long long)wal.stats.records,
+	       (unsigned long long)wal.stats.commits);
+	assert(wal.stats.records == THREADS * RECORDS_PER_THREAD);
+	assert(wal.stats.commits < wal.stats.records);
+	assert(wal_close(&wal) == 0);
+
+	int seen = 0;
+	assert(wal_replay(path, count_record, &seen) ==
+	       THREADS * RECORDS_PER_THREAD);
+	assert(seen == THREADS * RECORDS_PER_THREAD);
+
+	unlink(path);
+	printf("✓ WAL group commit tests passed\n\n");
+}
+
+#define TORN_RECORDS 16
+
+static void check_order(const struct mqtt_publish *pkt, void *arg)
+{
+	int *seen = arg;
+	assert(pkt->pkt_id == ++*seen);
+	assert(pkt->payloadlen == (size_t)pkt->pkt_id);
+}
+
+void test_torn_tail(void)
+{
+	printf("Testing WAL replay of a torn tail...\n");
+
+	char path[] = "/tmp/cmqtt_wal_XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd != -1);
+	close(fd);
+
+	struct acks done = { PTHREAD_MUTEX_INITIALIZER,
+			     PTHREAD_COND_INITIALIZER, 0, 0, NULL, 0 };
+	unsigned char payload[TORN_RECORDS];
+	long end[TORN_RECORDS];   // File offset one past each record
+	long offset = 0;
+
+	memset(payload, 'x', sizeof(payload));
+	assert(wal_open(&wal, path, 0) == 0);
+	for (int i = 0; i < TORN_RECORDS; i++) {
+		// Record i + 1 carries i + 1 payload bytes
+		struct mqtt_publish pkt = {
+			.header = { .byte = PUBLISH_BYTE | 0x02 },
+			.pkt_id = i + 1,
+			.topiclen = 3,
+			.topic = (unsigned char *)"a/b",
+			.payloadlen = i + 1,
+			.payload = payload,
+		};
+		assert(wal_append(&wal, &pkt, on_durable, &done) != 0);
+		offset += 2 * sizeof(uint32_t) + sizeof(uint8_t) +
+			  2 * sizeof(uint16_t) + 3 + sizeof(uint32_t) + i + 1;
+		end[i] = offset;
+	}
+	wait_acks(&done, TORN_RECORDS);
+	assert(done.error == 0);
+	assert(wal_close(&wal) == 0);
+
+	// Cut every record in half, from the last one down
+	for (int i = TORN_RECORDS - 1; i >= 0; i--) {
+		long start = i ? end[i - 1] : 0;
+		assert(truncate(path, start + (end[i] - start) / 2) == 0);
+		int seen = 0;
+		assert(wal_replay(path, check_order, &seen) == i);
+		assert(seen == i);
+	}
+
+	unlink(path);
+	printf("✓ WAL torn tail tests passed\n\n");
+}
+
+// Appends a record with a valid checksum whose topic and payload lengths
+// need not agree with its body
+static void append_forged(const char *path, uint16_t topiclen,
+			  uint32_t payloadlen)
+{
+	unsigned char record[64];
+	uint8_t *ptr = record + 2 * sizeof(uint32_t);
+	pack_u8(&ptr, PUBLISH_BYTE | 0x02);
+	pack_u16(&ptr, 1);
+	pack_u16(&ptr, topiclen);
+	pack_u32(&ptr, payloadlen);
+	pack_nbytes(&ptr, (const uint8_t *)"abc", 3);
+	uint32_t body = ptr - record - 2 * sizeof(uint32_t);
+	ptr = record;
+	pack_u32(&ptr, body);
+	pack_u32(&ptr, fnv1a(record + 2 * sizeof(uint32_t), body));
+
+	FILE *fp = fopen(path, "ab");
+	assert(fp);
+	assert(fwrite(record, 1, 2 * sizeof(uint32_t) + body, fp) ==
+	       2 * sizeof(uint32_t) + body);
+	fclose(fp);
+}
+
+void test_forged_lengths(void)
+{
+	printf("Testing WAL replay of inconsistent record lengths...\n");
+
+	char path[] = "/tmp/cmqtt_wal_XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd != -1);
+	close(fd);
+
+	// A consistent forged record replays like a logged one
+	append_forged(path, 0, 3);
+	assert(wal_replay(path, NULL, NULL) == 1);
+
+	// A topic running past the body ends the log
+	append_forged(path, 0xffff, 0);
+	append_forged(path, 0, 3);
+	assert(wal_replay(path, NULL, NULL) == 1);
+
+	// So does a payload length that disagrees with the body
+	assert(truncate(path, 0) == 0);
+	append_forged(path, 1, 1000);
+	assert(wal_replay(path, NULL, NULL) == 0);
+
+	unlink(path);
+	printf("✓ WAL inconsistent length tests passed\n\n");
+}
+
+void test_failed_commit(void)
+{
+	printf("Testing WAL commit failure...\n");
+
+	struct acks failed = { PTHREAD_MUTEX_INITIALIZER,
+			       PTHREAD_COND_INITIALIZER, 0, 0, NULL, 0 };
+	struct mqtt_publish pkt = {
+		.header = { .byte = PUBLISH_BYTE | 0x02 },
+		.pkt_id = 1,
+		.topiclen = 3,
+		.topic = (unsigned char *)"a/b",
+		.payloadlen = 2,
+		.payload = (unsigned char *)"hi",
+	};
+
+	// Every write to /dev/full fails with ENOSPC
+	assert(wal_open(&wal, "/dev/full", 0) == 0);
+	assert(wal_append(&wal, &pkt, on_durable, &failed) != 0);
+	wait_acks(&failed, 1);
+	assert(failed.error == ENOSPC);
+
+	// The failure is sticky, nothing is accepted afterwards
+	assert(wal_append(&wal, &pkt, on_durable, &failed) == 0);
+	assert(wal.stats.commits == 0);
+	assert(wal_close(&wal) == -1);
+	assert(failed.count == 1);
+
+	printf("✓ WAL commit failure tests passed\n\n");
+}
+
+int main(void)
+{
+	printf("Running WAL module unit tests\n");
+	printf("============================\n\n");
+
+	test_group_commit();
+	test_torn_tail();
+	test_forged_lengths();
+	test_failed_commit();
+
+	printf("All tests passed!\n");
+	return 0;
+}